@@ -0,0 +1,297 @@
+// Benchmarks for how many allocations each parse and resolve call makes,
+// counted through the library's allocation hooks and split by the library
+// call they were made in, and for how fast those calls run on other
+// allocators.  With --bench_perf, hardware counters for each block of ops
+// show whether a slow call is slow for its instructions or its misses.
+
+#include "ares-load.h"
+
+#include <functional>
+
+// Allocation counts per op for a record: totals, the size classes of the
+// requests, and the allocations made inside each library call.
+static BenchRecord &SetAllocs(BenchRecord &record, double ops)
+{
+  const CountingAllocator::Counts &c = CountingAllocator::counts();
+  unsigned long long requests = c.allocs_ + c.reallocs_;
+  std::string sizes;
+  for (int i = 0; i < CountingAllocator::kSizeClasses; i++) {
+    if (c.size_classes_[i] == 0)
+      continue;
+    char buf[48];
+    if (i == CountingAllocator::kSizeClasses - 1) {
+      snprintf(buf, sizeof(buf), "%s>%zu:%.1f%%", sizes.empty() ? "" : "/",
+               (size_t)8 << i, 100.0 * (double)c.size_classes_[i] / (double)requests);
+    } else {
+      snprintf(buf, sizeof(buf), "%s<=%zu:%.1f%%", sizes.empty() ? "" : "/",
+               (size_t)16 << i, 100.0 * (double)c.size_classes_[i] / (double)requests);
+    }
+    sizes += buf;
+  }
+  std::string by_api;
+  for (const auto &it : CountingAllocator::api_counts()) {
+    if (it.second.allocs_ + it.second.reallocs_ == 0)
+      continue;
+    char buf[96];
+    snprintf(buf, sizeof(buf), "%s%s:%.1f", by_api.empty() ? "" : "/",
+             it.first.c_str(), (double)(it.second.allocs_ + it.second.reallocs_) / ops);
+    by_api += buf;
+  }
+  return record.Set("allocs_per_op", (double)c.allocs_ / ops)
+    .Set("reallocs_per_op", (double)c.reallocs_ / ops)
+    .Set("frees_per_op", (double)c.frees_ / ops)
+    .Set("bytes_per_op", (double)c.requested_bytes_ / ops)
+    .Set("sizes", sizes.empty() ? std::string("-") : sizes)
+    .Set("by_api", by_api.empty() ? std::string("-") : by_api);
+}
+
+class ParseAllocsBenchTest : public LibraryTest {
+public:
+  struct Parser {
+    const char                                     *name;
+    std::function<DNSRR *(int)>                     record;
+    std::function<int(const std::vector<byte> &)>  parse;
+  };
+
+  // A reply to a question for name with count records.
+  static std::vector<byte> Reply(const std::string &name, int rrtype, size_t count,
+                                 const std::function<DNSRR *(int)> &record)
+  {
+    DNSPacket pkt;
+    pkt.set_response().set_aa().add_question(new DNSQuestion(name, rrtype));
+    for (size_t i = 0; i < count; i++)
+      pkt.add_answer(record((int)i));
+    return pkt.data();
+  }
+};
+
+TEST_F(ParseAllocsBenchTest, AllocsPerParse) {
+  const std::string name = "example.com";
+  const std::string ptrname = "4.3.2.1.in-addr.arpa";
+  const Parser parsers[] = {
+    {"a",
+     [&](int i) { return new DNSARR(name, 100, {1, 2, 3, (byte)i}); },
+     [](const std::vector<byte> &p) {
+       struct hostent *host = nullptr;
+       struct ares_addrttl ttls[64];
+       int nttls = 64;
+       int rc = ares_parse_a_reply(p.data(), (int)p.size(), &host, ttls, &nttls);
+       if (host)
+         ares_free_hostent(host);
+       return rc;
+     }},
+    {"aaaa",
+     [&](int i) {
+       return new DNSAaaaRR(name, 100, {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0,
+                                        0, 0, 0, 0, 0, 0, 0, (byte)i});
+     },
+     [](const std::vector<byte> &p) {
+       struct hostent *host = nullptr;
+       struct ares_addr6ttl ttls[64];
+       int nttls = 64;
+       int rc = ares_parse_aaaa_reply(p.data(), (int)p.size(), &host, ttls, &nttls);
+       if (host)
+         ares_free_hostent(host);
+       return rc;
+     }},
+    {"mx",
+     [&](int i) { return new DNSMxRR(name, 100, i, "mx" + std::to_string(i) + ".example.com"); },
+     [](const std::vector<byte> &p) {
+       struct ares_mx_reply *mx = nullptr;
+       int rc = ares_parse_mx_reply(p.data(), (int)p.size(), &mx);
+       ares_free_data(mx);
+       return rc;
+     }},
+    {"ns",
+     [&](int i) { return new DNSNsRR(name, 100, "ns" + std::to_string(i) + ".example.com"); },
+     [](const std::vector<byte> &p) {
+       struct hostent *host = nullptr;
+       int rc = ares_parse_ns_reply(p.data(), (int)p.size(), &host);
+       if (host)
+         ares_free_hostent(host);
+       return rc;
+     }},
+    {"ptr",
+     [&](int i) { return new DNSPtrRR(ptrname, 100, "host" + std::to_string(i) + ".example.com"); },
+     [](const std::vector<byte> &p) {
+       struct hostent *host = nullptr;
+       const byte addr[4] = {1, 2, 3, 4};
+       int rc = ares_parse_ptr_reply(p.data(), (int)p.size(), addr, sizeof(addr),
+                                     AF_INET, &host);
+       if (host)
+         ares_free_hostent(host);
+       return rc;
+     }},
+    {"srv",
+     [&](int i) {
+       return new DNSSrvRR(name, 100, i, 10, 5060, "sip" + std::to_string(i) + ".example.com");
+     },
+     [](const std::vector<byte> &p) {
+       struct ares_srv_reply *srv = nullptr;
+       int rc = ares_parse_srv_reply(p.data(), (int)p.size(), &srv);
+       ares_free_data(srv);
+       return rc;
+     }},
+    {"txt",
+     [&](int i) {
+       return new DNSTxtRR(name, 100, {"v=spf1 include:" + std::to_string(i), "second"});
+     },
+     [](const std::vector<byte> &p) {
+       struct ares_txt_reply *txt = nullptr;
+       int rc = ares_parse_txt_reply(p.data(), (int)p.size(), &txt);
+       ares_free_data(txt);
+       return rc;
+     }},
+    {"txt_ext",
+     [&](int i) {
+       return new DNSTxtRR(name, 100, {"v=spf1 include:" + std::to_string(i), "second"});
+     },
+     [](const std::vector<byte> &p) {
+       struct ares_txt_ext *txt = nullptr;
+       int rc = ares_parse_txt_reply_ext(p.data(), (int)p.size(), &txt);
+       ares_free_data(txt);
+       return rc;
+     }},
+    {"caa",
+     [&](int i) {
+       return new DNSCaaRR(name, 100, 0, "issue", "ca" + std::to_string(i) + ".example.net");
+     },
+     [](const std::vector<byte> &p) {
+       struct ares_caa_reply *caa = nullptr;
+       int rc = ares_parse_caa_reply(p.data(), (int)p.size(), &caa);
+       ares_free_data(caa);
+       return rc;
+     }},
+    {"uri",
+     [&](int i) {
+       return new DNSUriRR(name, 100, i, 10, "https://" + std::to_string(i) + ".example.com/");
+     },
+     [](const std::vector<byte> &p) {
+       struct ares_uri_reply *uri = nullptr;
+       int rc = ares_parse_uri_reply(p.data(), (int)p.size(), &uri);
+       ares_free_data(uri);
+       return rc;
+     }},
+    {"naptr",
+     [&](int i) {
+       return new DNSNaptrRR(name, 100, i, 10, "S", "SIP+D2U", "",
+                             "_sip._udp" + std::to_string(i) + ".example.com");
+     },
+     [](const std::vector<byte> &p) {
+       struct ares_naptr_reply *naptr = nullptr;
+       int rc = ares_parse_naptr_reply(p.data(), (int)p.size(), &naptr);
+       ares_free_data(naptr);
+       return rc;
+     }},
+    {"soa",
+     [&](int i) {
+       return new DNSSoaRR(name, 100, "ns1.example.com", "hostmaster.example.com",
+                           i, 3600, 600, 86400, 300);
+     },
+     [](const std::vector<byte> &p) {
+       struct ares_soa_reply *soa = nullptr;
+       int rc = ares_parse_soa_reply(p.data(), (int)p.size(), &soa);
+       ares_free_data(soa);
+       return rc;
+     }},
+  };
+  const size_t ops = 1000;
+  for (CountingAllocator::Backend backend :
+       {CountingAllocator::kMalloc, CountingAllocator::kPool, CountingAllocator::kArena}) {
+    CountingAllocator allocator(backend);
+    for (const Parser &parser : parsers) {
+      const bool single = strcmp(parser.name, "soa") == 0;
+      for (size_t count : {1, 10, 50}) {
+        if (single && count != 1)
+          continue;
+        std::string qname = strcmp(parser.name, "ptr") == 0 ? ptrname : name;
+        int rrtype = std::unique_ptr<DNSRR>(parser.record(0))->rrtype_;
+        std::vector<byte> reply = Reply(qname, rrtype, count, parser.record);
+
+        PerfCounters perf;
+        CountingAllocator::Reset();
+        unsigned long long begin = BenchNowNs();
+        perf.Start();
+        for (size_t i = 0; i < ops; i++) {
+          EXPECT_EQ(ARES_SUCCESS, parser.parse(reply));
+          // The result has been freed, so the whole arena can be reused.
+          if (backend == CountingAllocator::kArena)
+            CountingAllocator::ResetArena();
+        }
+        perf.Stop();
+        unsigned long long elapsed = BenchNowNs() - begin;
+        // Every parse gives back all that it allocated.
+        EXPECT_EQ(0LL, CountingAllocator::counts().live_blocks_);
+
+        BenchRecord record("ParseAllocs");
+        record.Set("allocator", CountingAllocator::BackendName(backend))
+          .Set("type", parser.name)
+          .Set("records", count)
+          .Set("ns_per_op", (double)elapsed / (double)ops);
+        perf.Set(record, (double)ops);
+        SetAllocs(record, (double)ops).Report();
+      }
+    }
+  }
+}
+
+class ResolveAllocsBenchTest : public MockChannelOptsTest {
+public:
+  ResolveAllocsBenchTest()
+    : MockChannelOptsTest(1, AF_INET, false, nullptr, 0),
+      zone_("first.com", 0, 0)
+  {
+    server_.SetZone(&zone_);
+  }
+
+protected:
+  LoadZone zone_;
+};
+
+// One lookup at a time, so that every op goes through the whole path from
+// the call to the callback, with no answers cached.  The mock server parses
+// each request with ares_expand_name(), so that entry in by_api is the
+// harness's and not the resolver's.
+TEST_F(ResolveAllocsBenchTest, AllocsPerResolve) {
+  // No arena: a channel keeps blocks across lookups, so there is no point
+  // at which the arena could be reset.
+  for (CountingAllocator::Backend backend :
+       {CountingAllocator::kMalloc, CountingAllocator::kPool}) {
+    for (const char *api : {"getaddrinfo", "gethostbyname", "search", "gethostbyaddr",
+                            "getnameinfo"}) {
+      // The channel's blocks must come from the backend under test.
+      CountingAllocator allocator(backend);
+      ares_channel_t *channel = NewChannel();
+      ASSERT_NE(nullptr, channel);
+
+      // Warm up, so that the socket opened for the first query is not
+      // counted.
+      LoadOptions opts;
+      opts.api         = api;
+      opts.outstanding = 1;
+      opts.duration_ms = 20;
+      LoadGenerator(opts, "first.com").Run(channel, this);
+
+      // The counts include the mock server, which runs on the same thread.
+      PerfCounters perf;
+      CountingAllocator::Reset();
+      opts.duration_ms = 200;
+      LoadGenerator gen(opts, "first.com");
+      perf.Start();
+      LoadResult result = gen.Run(channel, this);
+      perf.Stop();
+      ares_destroy(channel);
+      EXPECT_EQ(0ULL, result.failed_);
+      ASSERT_LT(0ULL, result.completed_);
+
+      BenchRecord record("ResolveAllocs");
+      record.Set("allocator", CountingAllocator::BackendName(backend))
+        .Set("api", api)
+        .Set("ops", result.completed_)
+        .Set("ns_per_op", (double)result.elapsed_ns_ / (double)result.completed_)
+        .Set("cpu_ns_per_op", (double)result.cpu_ns_ / (double)result.completed_);
+      perf.Set(record, (double)result.completed_);
+      SetAllocs(record, (double)result.completed_).Report();
+    }
+  }
+}
@@ -0,0 +1,142 @@
+// Benchmarks for tearing down large numbers of pending queries, either with
+// ares_cancel() (as on a configuration reload) or with ares_destroy().
+
+#include "ares-bench.h"
+#include "dns-proto.h"
+
+// No reply is ever configured on the mock server, so every query stays
+// pending until it is cancelled.
+class MassCancelBenchTest : public MockChannelOptsTest {
+public:
+  MassCancelBenchTest() : MockChannelOptsTest(1, AF_INET, false, nullptr, 0)
+  {
+  }
+
+  // Query IDs are 16 bits wide and the library needs a free one for every
+  // pending query, so large runs are spread across several channels.
+  static const size_t per_channel = 32768;
+
+  struct Tally {
+    Tally(int status) : status_(status), callbacks_(0), matched_(0), callback_ns_(0)
+    {
+    }
+
+    int                status_;
+    size_t             callbacks_;
+    size_t             matched_;
+    unsigned long long callback_ns_;
+  };
+
+  static void Count(Tally *tally, int status, unsigned long long begin)
+  {
+    tally->callbacks_++;
+    if (status == tally->status_)
+      tally->matched_++;
+    tally->callback_ns_ += BenchNowNs() - begin;
+  }
+
+  static void AddrInfoTally(void *data, int status, int timeouts,
+                            struct ares_addrinfo *ai)
+  {
+    unsigned long long begin = BenchNowNs();
+    (void)timeouts;
+    if (ai)
+      ares_freeaddrinfo(ai);
+    Count(reinterpret_cast<Tally *>(data), status, begin);
+  }
+
+  static void SearchTally(void *data, int status, int timeouts,
+                          unsigned char *abuf, int alen)
+  {
+    unsigned long long begin = BenchNowNs();
+    (void)timeouts;
+    (void)abuf;
+    (void)alen;
+    Count(reinterpret_cast<Tally *>(data), status, begin);
+  }
+
+  // Enqueue count queries of the given API and return the channels used.
+  std::vector<ares_channel_t *> Enqueue(const std::string &api, size_t count,
+                                        Tally *tally)
+  {
+    std::vector<ares_channel_t *> channels;
+    struct ares_addrinfo_hints hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_flags  = ARES_AI_NOSORT;
+    char name[64];
+    for (size_t i = 0; i < count; i++) {
+      if (i % per_channel == 0)
+        channels.push_back(NewChannel());
+      if (api == "getaddrinfo") {
+        snprintf(name, sizeof(name), "host%zu.example.com.", i);
+        ares_getaddrinfo(channels.back(), name, NULL, &hints, AddrInfoTally, tally);
+      } else {
+        snprintf(name, sizeof(name), "host%zu", i);
+        ares_search(channels.back(), name, C_IN, T_A, SearchTally, tally);
+      }
+    }
+    return channels;
+  }
+
+  void Run(const std::string &api, size_t count, bool destroy)
+  {
+    Tally tally(destroy ? ARES_EDESTRUCTION : ARES_ECANCELLED);
+
+    unsigned long long begin = BenchNowNs();
+    std::vector<ares_channel_t *> channels = Enqueue(api, count, &tally);
+    unsigned long long enqueue_ns = BenchNowNs() - begin;
+    EXPECT_EQ((size_t)0, tally.callbacks_);
+
+    // Each call blocks the caller's event loop, so the longest one is the
+    // stall an application would see.
+    unsigned long long total_ns = 0, stall_ns = 0;
+    for (ares_channel_t *channel : channels) {
+      unsigned long long t = BenchNowNs();
+      if (destroy) {
+        ares_destroy(channel);
+      } else {
+        ares_cancel(channel);
+      }
+      t = BenchNowNs() - t;
+      total_ns += t;
+      if (t > stall_ns)
+        stall_ns = t;
+    }
+    if (!destroy) {
+      for (ares_channel_t *channel : channels)
+        ares_destroy(channel);
+    }
+
+    EXPECT_EQ(count, tally.callbacks_);
+    EXPECT_EQ(count, tally.matched_);
+    BenchRecord(destroy ? "MassDestroy" : "MassCancel")
+      .Set("api", api)
+      .Set("pending", count)
+      .Set("channels", channels.size())
+      .Set("enqueue_ns_per_query", (double)enqueue_ns / (double)count)
+      .Set("total_ms", (double)total_ns / 1e6)
+      .Set("max_stall_ms", (double)stall_ns / 1e6)
+      .Set("ns_per_query", (double)total_ns / (double)count)
+      .Set("callbacks", tally.callbacks_)
+      .Set("callback_ns_per_query", (double)tally.callback_ns_ / (double)count)
+      .Set("library_ns_per_query",
+           (double)(total_ns - tally.callback_ns_) / (double)count)
+      .Report();
+  }
+};
+
+TEST_F(MassCancelBenchTest, Cancel) {
+  for (const char *api : {"getaddrinfo", "search"}) {
+    for (size_t count : BenchSizes({10000, 100000, 1000000})) {
+      Run(api, count, false);
+    }
+  }
+}
+
+TEST_F(MassCancelBenchTest, Destroy) {
+  for (const char *api : {"getaddrinfo", "search"}) {
+    for (size_t count : BenchSizes({10000, 100000, 1000000})) {
+      Run(api, count, true);
+    }
+  }
+}
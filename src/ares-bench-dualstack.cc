@@ -0,0 +1,129 @@
+// Benchmarks for AF_UNSPEC lookups when the A and AAAA answers do not come
+// back alike, as with upstreams that mishandle AAAA queries.
+
+#include "ares-load.h"
+
+// Short timeouts, so that a dropped query costs a fraction of a second
+// rather than the library default of several seconds; the costs scale with
+// the timeout.
+static struct ares_options *DualStackOptions()
+{
+  static struct ares_options opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.timeout = 200;
+  opts.tries   = 2;
+  return &opts;
+}
+
+class DualStackBenchTest : public MockChannelOptsTest {
+public:
+  DualStackBenchTest()
+    : MockChannelOptsTest(1, AF_INET, false, DualStackOptions(),
+                          ARES_OPT_TIMEOUTMS | ARES_OPT_TRIES),
+      zone_("first.com", 0, 0), lookups_(0)
+  {
+    server_.SetZone(&zone_);
+  }
+
+  struct Lookup {
+    Lookup() : status_(-1), v4_(0), v6_(0)
+    {
+    }
+
+    int    status_;
+    size_t v4_;
+    size_t v6_;
+  };
+
+  static void LookupCallback(void *data, int status, int timeouts,
+                             struct ares_addrinfo *ai)
+  {
+    (void)timeouts;
+    Lookup *lookup = reinterpret_cast<Lookup *>(data);
+    if (ai) {
+      for (struct ares_addrinfo_node *node = ai->nodes; node; node = node->ai_next) {
+        if (node->ai_family == AF_INET)
+          lookup->v4_++;
+        else
+          lookup->v6_++;
+      }
+      ares_freeaddrinfo(ai);
+    }
+    lookup->status_ = status;
+  }
+
+  // Resolve one new name with AF_UNSPEC and wait for it.
+  Lookup Resolve(unsigned long long *latency_ns)
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "host%zu.first.com", lookups_++);
+    struct ares_addrinfo_hints hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_flags  = ARES_AI_NOSORT;
+    Lookup lookup;
+    unsigned long long begin = BenchNowNs();
+    ares_getaddrinfo(channel_, name, NULL, &hints, LookupCallback, &lookup);
+    while (lookup.status_ == -1) {
+      struct timeval tv = {0, 1000};
+      ProcessStep(channel_, this, &tv);
+      server_.SendDelayedReplies();
+    }
+    *latency_ns = BenchNowNs() - begin;
+    return lookup;
+  }
+
+protected:
+  LoadZone zone_;
+  size_t   lookups_;
+};
+
+// One of the two record types is answered late, answered with SERVFAIL, or
+// never answered, while the other is answered at once.  Reports how long
+// the whole lookup takes and what it returns, on simulated time so that
+// the delays and timeouts are not waited for.
+TEST_F(DualStackBenchTest, SkewedFamilies) {
+  const size_t lookups = 10;
+  VirtualClock clock;
+  for (int rrtype : {T_AAAA, T_A}) {
+    for (const char *fault : {"none", "slow50", "slow500", "servfail", "drop"}) {
+      server_.SetFaultType(rrtype);
+      server_.SetFailRcode(strcmp(fault, "servfail") == 0 ? SERVFAIL : 0);
+      server_.SetDropRequests(strcmp(fault, "drop") == 0);
+      server_.SetReplyDelay(strcmp(fault, "slow50") == 0    ? 50
+                            : strcmp(fault, "slow500") == 0 ? 500
+                                                            : 0);
+
+      LatencyHistogram   latency;
+      unsigned long long ns;
+      size_t             ok = 0, v4 = 0, v6 = 0;
+      unsigned long      requests = server_.requests();
+      for (size_t i = 0; i < lookups; i++) {
+        Lookup lookup = Resolve(&ns);
+        latency.Add(ns);
+        if (lookup.status_ == ARES_SUCCESS)
+          ok++;
+        v4 += lookup.v4_;
+        v6 += lookup.v6_;
+      }
+      requests = server_.requests() - requests;
+
+      // The type that is answered normally is always returned.
+      EXPECT_EQ(lookups, rrtype == T_AAAA ? v4 : v6);
+      BenchRecord("DualStack")
+        .Set("faulty", rrtype == T_AAAA ? "AAAA" : "A")
+        .Set("fault", fault)
+        .Set("lookups", lookups)
+        .Set("succeeded", ok)
+        .Set("v4_addrs", v4)
+        .Set("v6_addrs", v6)
+        .Set("queries_per_lookup", (double)requests / (double)lookups)
+        .Set("p50_ms", (double)latency.Percentile(50) / 1e6)
+        .Set("max_ms", (double)latency.max() / 1e6)
+        .Report();
+    }
+  }
+  server_.SetFaultType(0);
+  server_.SetFailRcode(0);
+  server_.SetDropRequests(false);
+  server_.SetReplyDelay(0);
+}
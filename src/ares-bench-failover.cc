@@ -0,0 +1,192 @@
+// Benchmarks for server failover: what a failing or slow first server costs
+// each lookup, and how soon traffic goes back to it once it recovers.
+
+#include "ares-load.h"
+
+// Three mock servers in order; the first one is made to misbehave.
+class FailoverBenchTest : public MockChannelOptsTest {
+public:
+  FailoverBenchTest()
+    : MockChannelOptsTest(3, AF_INET, false, nullptr, 0),
+      zone_("first.com", 0, 0), lookups_(0)
+  {
+    for (const auto &server : servers_) {
+      server->SetZone(&zone_);
+      if (!csv_.empty())
+        csv_ += ",";
+      csv_ += "127.0.0.1:" + std::to_string(server->udpport());
+    }
+  }
+
+  // A channel on the mock servers with a short timeout, so that dropped
+  // requests fail over quickly, and the given failover settings.
+  ares_channel_t *FailoverChannel(unsigned short retry_chance, size_t retry_delay_ms)
+  {
+    struct ares_options opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.timeout                           = 200;
+    opts.tries                             = 3;
+    opts.server_failover_opts.retry_chance = retry_chance;
+    opts.server_failover_opts.retry_delay  = retry_delay_ms;
+    ares_channel_t *channel = nullptr;
+    EXPECT_EQ(ARES_SUCCESS,
+              ares_init_options(&channel, &opts,
+                                ARES_OPT_TIMEOUTMS | ARES_OPT_TRIES |
+                                ARES_OPT_SERVER_FAILOVER));
+    if (channel == nullptr)
+      return nullptr;
+    EXPECT_EQ(ARES_SUCCESS, ares_set_servers_ports_csv(channel, csv_.c_str()));
+    return channel;
+  }
+
+  static void ResolveCallback(void *data, int status, int timeouts,
+                              struct ares_addrinfo *ai)
+  {
+    (void)timeouts;
+    if (ai)
+      ares_freeaddrinfo(ai);
+    *reinterpret_cast<int *>(data) = status;
+  }
+
+  // Resolve one new name and wait for it, returning its status and latency
+  // and which servers it was sent to.
+  int Resolve(ares_channel_t *channel, unsigned long long *latency_ns,
+              std::vector<unsigned long> *sent)
+  {
+    std::vector<unsigned long> before;
+    for (const auto &server : servers_)
+      before.push_back(server->requests());
+
+    char name[64];
+    snprintf(name, sizeof(name), "host%zu.first.com", lookups_++);
+    struct ares_addrinfo_hints hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_flags  = ARES_AI_NOSORT;
+    int status = -1;
+    unsigned long long begin = BenchNowNs();
+    ares_getaddrinfo(channel, name, NULL, &hints, ResolveCallback, &status);
+    while (status == -1) {
+      struct timeval tv = {0, 1000};
+      ProcessStep(channel, this, &tv);
+      for (const auto &server : servers_)
+        server->SendDelayedReplies();
+    }
+    *latency_ns = BenchNowNs() - begin;
+
+    sent->clear();
+    for (size_t i = 0; i < servers_.size(); i++)
+      sent->push_back(servers_[i]->requests() - before[i]);
+    return status;
+  }
+
+  void SetFault(MockServer *server, const std::string &fault)
+  {
+    server->SetFailRcode(fault == "servfail" ? SERVFAIL
+                         : fault == "notimp" ? NOTIMP
+                         : fault == "refused" ? REFUSED
+                                              : 0);
+    server->SetDropRequests(fault == "drop");
+    server->SetReplyDelay(fault == "slow" ? 50 : 0);
+  }
+
+protected:
+  LoadZone    zone_;
+  std::string csv_;
+  size_t      lookups_;
+};
+
+// Sequential lookups with the first server failing in each way in turn.
+// The first lookup pays for discovering the failure; later ones show how
+// well the channel keeps away from the failed server, apart from the
+// occasional probe to see whether it is back.  Timeouts and slow replies
+// run on simulated time, so latencies are what a real run would see but
+// are not waited for.
+TEST_F(FailoverBenchTest, FailingServer) {
+  const size_t lookups = 200;
+  VirtualClock clock;
+  for (const char *fault : {"none", "servfail", "notimp", "refused", "drop", "slow"}) {
+    ares_channel_t *channel = FailoverChannel(10, 5000);
+    ASSERT_NE(nullptr, channel);
+    SetFault(servers_[0].get(), fault);
+
+    LatencyHistogram           latency;
+    unsigned long long         first_ns = 0, ns;
+    unsigned long long         sent = 0, faulty = 0, failed = 0;
+    std::vector<unsigned long> per_server;
+    for (size_t i = 0; i < lookups; i++) {
+      if (Resolve(channel, &ns, &per_server) != ARES_SUCCESS)
+        failed++;
+      if (i == 0)
+        first_ns = ns;
+      latency.Add(ns);
+      for (unsigned long count : per_server)
+        sent += count;
+      faulty += per_server[0];
+    }
+    ares_destroy(channel);
+    SetFault(servers_[0].get(), "none");
+
+    // Every fault here is one the channel fails over from (a slow server
+    // is just slow), so every lookup still succeeds.
+    EXPECT_EQ(0ULL, failed);
+    BenchRecord("Failover")
+      .Set("fault", fault)
+      .Set("lookups", lookups)
+      .Set("failed", failed)
+      .Set("first_ms", (double)first_ns / 1e6)
+      .Set("p50_us", (double)latency.Percentile(50) / 1e3)
+      .Set("p99_us", (double)latency.Percentile(99) / 1e3)
+      .Set("max_us", (double)latency.max() / 1e3)
+      .Set("retries_per_lookup", (double)(sent - lookups) / (double)lookups)
+      .Set("faulty_server_requests", faulty)
+      .Report();
+  }
+}
+
+// The first server answers SERVFAIL until the channel has moved off it,
+// then is restored.  Measures how long, and how many lookups, it takes
+// before a lookup is answered by the first server again, and what share of
+// the lookups after that go to it.
+TEST_F(FailoverBenchTest, Recovery) {
+  const unsigned long long limit_ns = 3000000000ULL;
+  const size_t             after    = 100;
+  for (unsigned short retry_chance : {1, 10}) {
+    for (size_t retry_delay_ms : {10, 100, 1000}) {
+      ares_channel_t *channel = FailoverChannel(retry_chance, retry_delay_ms);
+      ASSERT_NE(nullptr, channel);
+      unsigned long long         ns;
+      std::vector<unsigned long> per_server;
+      SetFault(servers_[0].get(), "servfail");
+      for (size_t i = 0; i < 10; i++)
+        EXPECT_EQ(ARES_SUCCESS, Resolve(channel, &ns, &per_server));
+      SetFault(servers_[0].get(), "none");
+
+      unsigned long long restored = BenchNowNs();
+      unsigned long long recover_ns = 0;
+      size_t             until = 0;
+      bool               recovered = false;
+      while (!recovered && (recover_ns = BenchNowNs() - restored) < limit_ns) {
+        EXPECT_EQ(ARES_SUCCESS, Resolve(channel, &ns, &per_server));
+        until++;
+        recovered = per_server[0] > 0;
+      }
+      size_t primary = 0;
+      for (size_t i = 0; recovered && i < after; i++) {
+        EXPECT_EQ(ARES_SUCCESS, Resolve(channel, &ns, &per_server));
+        if (per_server[0] > 0)
+          primary++;
+      }
+      ares_destroy(channel);
+
+      EXPECT_TRUE(recovered);
+      BenchRecord("FailoverRecovery")
+        .Set("retry_chance", (unsigned int)retry_chance)
+        .Set("retry_delay_ms", retry_delay_ms)
+        .Set("recovered", recovered ? "yes" : "no")
+        .Set("recover_ms", (double)recover_ns / 1e6)
+        .Set("lookups_to_recover", until)
+        .Set("primary_share_after", (double)primary / (double)after)
+        .Report();
+    }
+  }
+}
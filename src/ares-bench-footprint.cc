@@ -0,0 +1,147 @@
+// Benchmarks for the memory each outstanding query holds, counted through
+// the library's allocation hooks while queries wait on a server that never
+// answers.
+
+#include "ares-load.h"
+
+class FootprintBenchTest : public MockChannelOptsTest {
+public:
+  FootprintBenchTest()
+    : MockChannelOptsTest(1, AF_INET, false, nullptr, 0),
+      zone_("first.com", 0, 0)
+  {
+    server_.SetZone(&zone_);
+    server_.SetDropRequests(true);
+  }
+
+  // DNS only and no search domains, with a timeout long enough that no
+  // query is retried while it is being counted.
+  ares_channel_t *FootprintChannel()
+  {
+    struct ares_options opts;
+    static char         lookups[] = "b";
+    memset(&opts, 0, sizeof(opts));
+    opts.timeout  = 60000;
+    opts.tries    = 1;
+    opts.lookups  = lookups;
+    opts.ndomains = 0;
+    ares_channel_t *channel = nullptr;
+    EXPECT_EQ(ARES_SUCCESS,
+              ares_init_options(&channel, &opts,
+                                ARES_OPT_TIMEOUTMS | ARES_OPT_TRIES |
+                                ARES_OPT_LOOKUPS | ARES_OPT_DOMAINS));
+    if (channel == nullptr)
+      return nullptr;
+    std::string csv = "127.0.0.1:" + std::to_string(server_.udpport());
+    EXPECT_EQ(ARES_SUCCESS, ares_set_servers_ports_csv(channel, csv.c_str()));
+    return channel;
+  }
+
+  static void AddrInfoDone(void *data, int status, int timeouts,
+                           struct ares_addrinfo *ai)
+  {
+    (void)status;
+    (void)timeouts;
+    if (ai)
+      ares_freeaddrinfo(ai);
+    (*reinterpret_cast<size_t *>(data))++;
+  }
+
+  static void HostDone(void *data, int status, int timeouts,
+                       struct hostent *hostent)
+  {
+    (void)status;
+    (void)timeouts;
+    (void)hostent;
+    (*reinterpret_cast<size_t *>(data))++;
+  }
+
+  static void SearchDone(void *data, int status, int timeouts,
+                         unsigned char *abuf, int alen)
+  {
+    (void)status;
+    (void)timeouts;
+    (void)abuf;
+    (void)alen;
+    (*reinterpret_cast<size_t *>(data))++;
+  }
+
+  static void NameInfoDone(void *data, int status, int timeouts,
+                           char *node, char *service)
+  {
+    (void)status;
+    (void)timeouts;
+    (void)node;
+    (void)service;
+    (*reinterpret_cast<size_t *>(data))++;
+  }
+
+  // Start the index'th query of the given API on channel.
+  static void Enqueue(ares_channel_t *channel, const std::string &api,
+                      size_t index, size_t *done)
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "host%zu.first.com", index);
+    if (api == "getaddrinfo") {
+      struct ares_addrinfo_hints hints = {};
+      hints.ai_family = AF_INET;
+      hints.ai_flags  = ARES_AI_NOSORT;
+      ares_getaddrinfo(channel, name, NULL, &hints, AddrInfoDone, done);
+    } else if (api == "gethostbyname") {
+      ares_gethostbyname(channel, name, AF_INET, HostDone, done);
+    } else if (api == "search") {
+      ares_search(channel, name, C_IN, T_A, SearchDone, done);
+    } else {
+      struct sockaddr_storage addr;
+      LoadGenerator::Address(index, AF_INET, &addr);
+      ares_getnameinfo(channel, (struct sockaddr *)&addr,
+                       sizeof(struct sockaddr_in), ARES_NI_LOOKUPHOST,
+                       NameInfoDone, done);
+    }
+  }
+
+protected:
+  LoadZone zone_;
+};
+
+// Enqueue N queries and count what the library holds while they wait.
+// At N=1 the figures include the socket and connection opened for the
+// first query; at larger N they approach the marginal cost of one more
+// query.
+TEST_F(FootprintBenchTest, PendingQuery) {
+  CountingAllocator allocator;
+  for (const char *api : {"getaddrinfo", "gethostbyname", "search", "getnameinfo"}) {
+    for (size_t count : BenchSizes({1, 10, 100, 1000, 10000})) {
+      CountingAllocator::Counts baseline = CountingAllocator::counts();
+      ares_channel_t *channel = FootprintChannel();
+      ASSERT_NE(nullptr, channel);
+      CountingAllocator::Counts before = CountingAllocator::counts();
+
+      size_t done = 0;
+      for (size_t i = 0; i < count; i++)
+        Enqueue(channel, api, i, &done);
+      CountingAllocator::Counts after = CountingAllocator::counts();
+      EXPECT_EQ(0U, done);
+
+      ares_destroy(channel);
+      EXPECT_EQ(count, done);
+      // Everything the channel and its queries held has been given back.
+      EXPECT_EQ(baseline.live_blocks_, CountingAllocator::counts().live_blocks_);
+      EXPECT_EQ(baseline.live_bytes_, CountingAllocator::counts().live_bytes_);
+
+      double per_query = 1.0 / (double)count;
+      BenchRecord("PendingQueryFootprint")
+        .Set("api", api)
+        .Set("queries", count)
+        .Set("channel_bytes", (unsigned long long)(before.live_bytes_ - baseline.live_bytes_))
+        .Set("bytes_per_query", (double)(after.live_bytes_ - before.live_bytes_) * per_query)
+        .Set("blocks_per_query", (double)(after.live_blocks_ - before.live_blocks_) * per_query)
+        .Set("allocs_per_query",
+             (double)(after.allocs_ + after.reallocs_ - before.allocs_ - before.reallocs_) *
+               per_query)
+        .Set("requested_bytes_per_query",
+             (double)(after.requested_bytes_ - before.requested_bytes_) * per_query)
+        .Report();
+    }
+  }
+}
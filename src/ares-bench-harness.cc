@@ -0,0 +1,143 @@
+// Benchmarks for the test harness itself, so that its own cost can be told
+// apart from the cost of the library under test.
+
+#include "ares-bench.h"
+#include "dns-proto.h"
+
+class HarnessBenchTest : public MockChannelOptsTest {
+public:
+  HarnessBenchTest() : MockChannelOptsTest(1, AF_INET, false, nullptr, 0)
+  {
+    // TTL of zero keeps the answer out of the query cache, so every query
+    // makes a round trip through the mock server.
+    DNSPacket rsp;
+    rsp.set_response().set_aa()
+      .add_question(new DNSQuestion("www.example.com", T_A))
+      .add_answer(new DNSARR("www.example.com", 0, {2, 3, 4, 5}));
+    server_.SetReply(&rsp);
+  }
+
+  static void CountCallback(void *data, int status, int timeouts,
+                            struct ares_addrinfo *ai)
+  {
+    (void)status;
+    (void)timeouts;
+    (*reinterpret_cast<size_t *>(data))++;
+    ares_freeaddrinfo(ai);
+  }
+
+  // Resolve count names, batch at a time, and return the driver's accounting.
+  ProcessStats Run(size_t count, size_t batch, bool cached)
+  {
+    using namespace std::placeholders;
+    ProcessStats stats;
+    size_t       completed = 0;
+    size_t       issued    = 0;
+    struct ares_addrinfo_hints hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_flags  = ARES_AI_NOSORT;
+    while (issued < count) {
+      for (size_t i = 0; i < batch && issued < count; i++, issued++) {
+        ares_getaddrinfo(channel_, "www.example.com.", NULL, &hints,
+                         CountCallback, &completed);
+      }
+      if (cached) {
+        ProcessWork(channel_, this, 0, &stats);
+      } else {
+        ProcessWork(channel_,
+                    std::bind(&HarnessBenchTest::fds, this),
+                    std::bind(&HarnessBenchTest::ProcessFD, this, _1),
+                    0, &stats);
+      }
+    }
+    EXPECT_EQ(count, completed);
+    return stats;
+  }
+};
+
+// Each case is run several times and the run with the least overhead is
+// reported: a wall clock ratio is skewed upwards by whatever else the
+// machine is doing, never downwards.
+TEST_F(HarnessBenchTest, ProcessWorkOverhead) {
+  const size_t batch   = 100;
+  const int    repeats = 5;
+  for (size_t count : BenchSizes({1000, 10000, 100000})) {
+    double function_overhead = 1.0;
+    for (bool cached : {false, true}) {
+      ProcessStats best;
+      double       overhead = 1.0;
+      for (int i = 0; i < repeats; i++) {
+        ProcessStats stats = Run(count, batch, cached);
+        double ratio = (double)stats.harness_ns_ / (double)stats.total_ns_;
+        if (ratio < overhead) {
+          overhead = ratio;
+          best     = stats;
+        }
+      }
+      BenchRecord("ProcessWorkOverhead")
+        .Set("driver", cached ? "cached" : "function")
+        .Set("queries", count)
+        .Set("repeats", repeats)
+        .Set("iterations", best.iterations_)
+        .Set("ns_per_query", (double)best.total_ns_ / (double)count)
+        .Set("harness_ns_per_query", (double)best.harness_ns_ / (double)count)
+        .Set("harness_pct", overhead * 100.0)
+        .Report();
+      if (cached) {
+        // The cached driver must stay under 1% of the cost per query, and
+        // cheaper than rebuilding the descriptor list every iteration.
+        EXPECT_LT(overhead, 0.01);
+        EXPECT_LT(overhead, function_overhead);
+      } else {
+        function_overhead = overhead;
+      }
+    }
+  }
+}
+
+// Lookups that time out on every try, with the real clock and with a
+// VirtualClock.  The channel's timeouts are cut short so that the real
+// clock rows finish in a reasonable time; with the default ones each
+// lookup would take seconds.
+TEST_F(HarnessBenchTest, VirtualClockTimeouts) {
+  server_.SetReplyData(std::vector<byte>());
+  for (bool simulated : {false, true}) {
+    struct ares_options opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.timeout = 100;
+    opts.tries   = 2;
+    ares_channel_t *channel = nullptr;
+    ASSERT_EQ(ARES_SUCCESS, ares_init_options(&channel, &opts,
+                                              ARES_OPT_TIMEOUTMS | ARES_OPT_TRIES));
+    std::string csv = "127.0.0.1:" + std::to_string(server_.udpport());
+    EXPECT_EQ(ARES_SUCCESS, ares_set_servers_ports_csv(channel, csv.c_str()));
+
+    std::unique_ptr<VirtualClock> clock(simulated ? new VirtualClock : nullptr);
+    const size_t       lookups = simulated ? 1000 : 3;
+    unsigned long long skipped = VirtualClock::skipped_ns();
+    struct timespec    begin, end;
+    size_t             completed = 0;
+    struct ares_addrinfo_hints hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_flags  = ARES_AI_NOSORT;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+    for (size_t i = 0; i < lookups; i++) {
+      ares_getaddrinfo(channel, "www.example.com.", NULL, &hints,
+                       CountCallback, &completed);
+      ProcessWork(channel, this);
+    }
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    ares_destroy(channel);
+    EXPECT_EQ(lookups, completed);
+
+    double real_ns = (double)(end.tv_sec - begin.tv_sec) * 1e9 +
+                     (double)(end.tv_nsec - begin.tv_nsec);
+    BenchRecord("VirtualClockTimeouts")
+      .Set("clock", simulated ? "virtual" : "real")
+      .Set("lookups", lookups)
+      .Set("real_us_per_lookup", real_ns / 1e3 / (double)lookups)
+      .Set("skipped_ms_per_lookup",
+           (double)(VirtualClock::skipped_ns() - skipped) / 1e6 / (double)lookups)
+      .Report();
+  }
+}
@@ -0,0 +1,161 @@
+// Benchmarks for lookups against a very large hosts file, such as those
+// shipped as blocklists.
+
+#include "ares-bench.h"
+
+#include <sstream>
+#include <sys/time.h>
+#include <unistd.h>
+
+class HostsFileBenchTest : public LibraryTest {
+public:
+  // Half the entries are IPv4 and half IPv6, each with a canonical name
+  // and several aliases.
+  static std::string HostsFile(size_t entries)
+  {
+    std::stringstream ss;
+    ss << "127.0.0.1 localhost\n";
+    for (size_t i = 0; i < entries; i++) {
+      if (i % 2 == 0) {
+        ss << "10." << ((i >> 16) & 0xff) << "." << ((i >> 8) & 0xff) << "."
+           << (i & 0xff);
+      } else {
+        ss << "fd00::" << std::hex << ((i >> 16) & 0xffff) << ":"
+           << (i & 0xffff) << std::dec;
+      }
+      ss << " host" << i << ".hosts.example";
+      for (int alias = 0; alias < 4; alias++)
+        ss << " alias" << alias << "-" << i;
+      ss << "\n";
+    }
+    return ss.str();
+  }
+
+  static std::string Name(size_t i, bool alias)
+  {
+    std::stringstream ss;
+    if (alias) {
+      ss << "alias" << (i % 4) << "-" << i;
+    } else {
+      ss << "host" << i << ".hosts.example";
+    }
+    return ss.str();
+  }
+
+  static int Family(size_t i)
+  {
+    return (i % 2 == 0) ? AF_INET : AF_INET6;
+  }
+
+  static void CountCallback(void *data, int status, int timeouts,
+                            struct ares_addrinfo *ai)
+  {
+    (void)timeouts;
+    if (ai)
+      ares_freeaddrinfo(ai);
+    if (status == ARES_SUCCESS)
+      (*reinterpret_cast<size_t *>(data))++;
+  }
+
+  ares_channel_t *NewChannel(const ConfigSandbox &sandbox)
+  {
+    struct ares_options opts;
+    memset(&opts, 0, sizeof(opts));
+    int optmask = sandbox.Apply(&opts);
+    ares_channel_t *channel = nullptr;
+    EXPECT_EQ(ARES_SUCCESS, ares_init_options(&channel, &opts, optmask));
+    return channel;
+  }
+
+  // Time one ares_gethostbyname_file() call, which must succeed.
+  static unsigned long long TimeFileLookup(ares_channel_t *channel, size_t i,
+                                           bool alias)
+  {
+    std::string     name = Name(i, alias);
+    struct hostent *host = nullptr;
+    unsigned long long begin = BenchNowNs();
+    int status = ares_gethostbyname_file(channel, name.c_str(), Family(i), &host);
+    unsigned long long ns = BenchNowNs() - begin;
+    EXPECT_EQ(ARES_SUCCESS, status) << name;
+    if (host)
+      ares_free_hostent(host);
+    return ns;
+  }
+};
+
+TEST_F(HostsFileBenchTest, Lookup) {
+  const size_t lookups = 10000;
+  for (size_t entries : BenchSizes({10000, 100000, 1000000})) {
+    ConfigSandbox sandbox;
+    // Files only, so getaddrinfo never falls through to DNS.
+    sandbox.WriteNsswitch("hosts: files\n");
+    sandbox.WriteHosts(HostsFile(entries));
+    // The library reloads the file while its modification time is not older
+    // than the second it was loaded in, so date it well before that.
+    struct timeval times[2];
+    gettimeofday(&times[0], NULL);
+    times[0].tv_sec -= 2;
+    times[0].tv_usec = 0;
+    times[1] = times[0];
+    EXPECT_EQ(0, utimes(sandbox.hosts_path().c_str(), times));
+    ares_channel_t *channel = NewChannel(sandbox);
+
+    // The first lookup parses the whole file.
+    unsigned long long first_ns = TimeFileLookup(channel, entries - 1, false);
+    time_t loaded = time(NULL);
+
+    // Spread lookups over the file, alternating canonical names and aliases.
+    unsigned long long hit_ns = 0, miss_ns = 0;
+    for (size_t n = 0; n < lookups; n++) {
+      size_t i = (n * 7919) % entries;
+      hit_ns += TimeFileLookup(channel, i, n % 2 == 1);
+    }
+    for (size_t n = 0; n < lookups; n++) {
+      struct hostent *host = nullptr;
+      std::string name = "missing" + std::to_string(n) + ".hosts.example";
+      unsigned long long begin = BenchNowNs();
+      EXPECT_EQ(ARES_ENOTFOUND,
+                ares_gethostbyname_file(channel, name.c_str(), AF_INET, &host));
+      miss_ns += BenchNowNs() - begin;
+    }
+
+    // The files lookup inside getaddrinfo, which completes synchronously.
+    size_t completed = 0;
+    struct ares_addrinfo_hints hints = {};
+    hints.ai_flags = ARES_AI_NOSORT;
+    unsigned long long begin = BenchNowNs();
+    for (size_t n = 0; n < lookups; n++) {
+      size_t i = (n * 7919) % entries;
+      hints.ai_family = Family(i);
+      ares_getaddrinfo(channel, Name(i, n % 2 == 1).c_str(), NULL, &hints,
+                       CountCallback, &completed);
+    }
+    unsigned long long gai_ns = BenchNowNs() - begin;
+    EXPECT_EQ(lookups, completed);
+
+    // Date the file to the second it was loaded in, so that the next lookup
+    // reloads it.  That reload must be stamped in a later second, as it
+    // would be for a real update, or the lookups after it would reload the
+    // file again.
+    times[0].tv_sec = loaded;
+    times[1]        = times[0];
+    EXPECT_EQ(0, utimes(sandbox.hosts_path().c_str(), times));
+    while (time(NULL) <= loaded)
+      usleep(10000);
+    unsigned long long reload_ns = TimeFileLookup(channel, 0, false);
+    unsigned long long after_ns  = TimeFileLookup(channel, 0, false);
+
+    ares_destroy(channel);
+
+    BenchRecord("HostsFile")
+      .Set("entries", entries)
+      .Set("first_load_ms", (double)first_ns / 1e6)
+      .Set("reload_ms", (double)reload_ns / 1e6)
+      .Set("after_reload_us", (double)after_ns / 1e3)
+      .Set("lookups", lookups)
+      .Set("file_hit_us", (double)hit_ns / 1e3 / (double)lookups)
+      .Set("file_miss_us", (double)miss_ns / 1e3 / (double)lookups)
+      .Set("getaddrinfo_us", (double)gai_ns / 1e3 / (double)lookups)
+      .Report();
+  }
+}
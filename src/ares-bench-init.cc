@@ -0,0 +1,100 @@
+// Benchmarks for channel initialisation cost as the resolver configuration
+// grows, using generated configuration files rather than the host's.
+
+#include "ares-bench.h"
+
+#include <algorithm>
+#include <sstream>
+
+class InitBenchTest : public LibraryTest {
+public:
+  struct Config {
+    int nameservers;
+    int domains;
+    int options;
+  };
+
+  static std::string ResolvConf(const Config &config)
+  {
+    std::stringstream ss;
+    for (int i = 0; i < config.nameservers; i++)
+      ss << "nameserver 10." << (i >> 8) << "." << (i & 0xff) << ".53\n";
+    if (config.domains > 0) {
+      ss << "search";
+      for (int i = 0; i < config.domains; i++)
+        ss << " ns" << i << ".svc.cluster" << i << ".example.com";
+      ss << "\n";
+    }
+    // Repeated options are legal; later ones win.
+    static const char *options[] = {"ndots:5", "timeout:2", "attempts:3",
+                                    "rotate"};
+    for (int i = 0; i < config.options; i++)
+      ss << "options " << options[i % 4] << "\n";
+    return ss.str();
+  }
+
+  // Make sure the generated configuration is the one actually in use.
+  static void Check(const ConfigSandbox &sandbox, const Config &config)
+  {
+    struct ares_options opts;
+    memset(&opts, 0, sizeof(opts));
+    int optmask = sandbox.Apply(&opts);
+    ares_channel_t *channel = nullptr;
+    EXPECT_EQ(ARES_SUCCESS, ares_init_options(&channel, &opts, optmask));
+    char *servers = ares_get_servers_csv(channel);
+    ASSERT_NE(nullptr, servers);
+    std::string csv(servers);
+    ares_free_string(servers);
+    EXPECT_EQ(config.nameservers, (int)std::count(csv.begin(), csv.end(), ',') + 1);
+    EXPECT_EQ(0u, csv.find("10.0.0.53:53")) << csv;
+    ares_destroy(channel);
+  }
+
+  // Initialise and destroy a channel iterations times, returning the
+  // initialisation time of each.
+  std::vector<unsigned long long> Run(const ConfigSandbox &sandbox,
+                                      int iterations)
+  {
+    std::vector<unsigned long long> times;
+    struct ares_options opts;
+    memset(&opts, 0, sizeof(opts));
+    int optmask = sandbox.Apply(&opts);
+    for (int i = 0; i < iterations; i++) {
+      ares_channel_t *channel = nullptr;
+      unsigned long long begin = BenchNowNs();
+      EXPECT_EQ(ARES_SUCCESS, ares_init_options(&channel, &opts, optmask));
+      times.push_back(BenchNowNs() - begin);
+      ares_destroy(channel);
+    }
+    std::sort(times.begin(), times.end());
+    return times;
+  }
+};
+
+TEST_F(InitBenchTest, ConfigSize) {
+  const int iterations = 200;
+  // Grow each dimension on its own, then all together.
+  std::vector<InitBenchTest::Config> configs = {
+    {1, 0, 0},   {3, 0, 0},   {16, 0, 0},  {64, 0, 0},
+    {1, 6, 0},   {1, 32, 0},  {1, 256, 0},
+    {1, 0, 4},   {1, 0, 16},  {1, 0, 64},
+    {64, 256, 64}};
+  for (const auto &config : configs) {
+    ConfigSandbox sandbox;
+    sandbox.WriteResolvConf(ResolvConf(config));
+    Check(sandbox, config);
+    std::vector<unsigned long long> times = Run(sandbox, iterations);
+    unsigned long long total = 0;
+    for (unsigned long long t : times)
+      total += t;
+    BenchRecord("InitConfig")
+      .Set("nameservers", config.nameservers)
+      .Set("domains", config.domains)
+      .Set("options", config.options)
+      .Set("iterations", iterations)
+      .Set("mean_us", (double)total / 1e3 / (double)iterations)
+      .Set("p50_us", (double)times[times.size() / 2] / 1e3)
+      .Set("p99_us", (double)times[times.size() * 99 / 100] / 1e3)
+      .Report();
+  }
+}
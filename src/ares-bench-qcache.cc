@@ -0,0 +1,227 @@
+// Benchmarks for the query cache: how often it hits for a skewed workload,
+// what a hit costs compared with a round trip, and how much memory it holds
+// as the working set grows.
+
+#include "ares-load.h"
+
+// Same cache settings as DefaultChannelTest, but against a mock server.
+static struct ares_options *QueryCacheOptions()
+{
+  static struct ares_options opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.qcache_max_ttl = 300;
+  return &opts;
+}
+
+// A LoadZone that remembers which names it has answered, so that a name
+// asked for again can be told from a first fetch.
+class SeenZone : public LoadZone {
+public:
+  SeenZone(const std::string &suffix, unsigned int ttl_min, unsigned int ttl_max)
+    : LoadZone(suffix, ttl_min, ttl_max), refetches_(0)
+  {
+  }
+
+  void Reset()
+  {
+    seen_.clear();
+    refetches_ = 0;
+  }
+
+  size_t seen() const
+  {
+    return seen_.size();
+  }
+
+  unsigned long long refetches() const
+  {
+    return refetches_;
+  }
+
+protected:
+  int Records(const std::string &name, int rrtype,
+              std::vector<byte> *reply) const override
+  {
+    if (!seen_.insert(name + "/" + std::to_string(rrtype)).second)
+      refetches_++;
+    return LoadZone::Records(name, rrtype, reply);
+  }
+
+private:
+  mutable std::set<std::string> seen_;
+  mutable unsigned long long    refetches_;
+};
+
+class QueryCacheBenchTest : public MockChannelOptsTest {
+public:
+  QueryCacheBenchTest()
+    : MockChannelOptsTest(1, AF_INET, false, QueryCacheOptions(),
+                          ARES_OPT_QUERY_CACHE),
+      // TTLs from 1s to 10 minutes: the short end expires during a run and
+      // the long end is clamped by qcache_max_ttl.
+      zone_("first.com", 1, 600)
+  {
+    server_.SetZone(&zone_);
+  }
+
+protected:
+  SeenZone zone_;
+};
+
+// Memory is divided by the names actually fetched, which for the larger
+// sizes is far fewer than the names the load draws from.  The cache has no
+// size limit, so names fetched again were dropped when their TTL expired
+// (or were asked for again while the first fetch was still in flight).
+TEST_F(QueryCacheBenchTest, ZipfWorkingSet) {
+  for (size_t names : BenchSizes({100, 1000, 10000, 100000, 1000000})) {
+    LoadOptions opts;
+    opts.names       = names;
+    opts.zipf        = 1.0;
+    opts.duration_ms = 500;
+    LoadGenerator gen(opts, "first.com");
+
+    // A fresh channel per size, so each starts with an empty cache.  Only
+    // what the library holds is counted, not the harness's own state.
+    CountingAllocator allocator;
+    ares_channel_t *channel = NewChannel();
+    long long live = CountingAllocator::counts().live_bytes_;
+    unsigned long long requests = server_.requests();
+    zone_.Reset();
+    LoadResult warm = gen.Run(channel, this);
+    long long          warm_live      = CountingAllocator::counts().live_bytes_;
+    size_t             warm_seen      = zone_.seen();
+    unsigned long long warm_refetches = zone_.refetches();
+    LoadResult steady = gen.Run(channel, this);
+    long long steady_live = CountingAllocator::counts().live_bytes_;
+    requests = server_.requests() - requests;
+    ares_destroy(channel);
+
+    EXPECT_EQ(0ULL, warm.failed_ + steady.failed_);
+    // Every miss is one round trip; anything else came from the cache.
+    EXPECT_GE(warm.completed_ + steady.completed_ + 2 * opts.outstanding,
+              requests);
+
+    struct {
+      const char        *phase;
+      const LoadResult  *result;
+      long long          live;
+      size_t             fetched;
+      unsigned long long refetches;
+    } phases[] = {{"warm", &warm, warm_live, warm_seen, warm_refetches},
+                  {"steady", &steady, steady_live, zone_.seen(),
+                   zone_.refetches() - warm_refetches}};
+    for (const auto &phase : phases) {
+      BenchRecord record("QueryCache");
+      record.Set("names", names)
+        .Set("zipf", opts.zipf)
+        .Set("phase", phase.phase)
+        .Set("fetched_names", phase.fetched)
+        .Set("refetches", phase.refetches)
+        .Set("live_growth_kb", (double)(phase.live - live) / 1024.0)
+        .Set("live_bytes_per_name",
+             (double)(phase.live - live) / (double)(phase.fetched ? phase.fetched : 1));
+      phase.result->Report(record).Report();
+    }
+  }
+}
+
+// Short TTLs, as served for service discovery, so that entries keep
+// expiring and being fetched again while the same names are queried
+// round and round.  Fixed TTLs of 0 (never cached) and 300 (never expires
+// within the run) bracket the result.
+TEST_F(QueryCacheBenchTest, TTLChurn) {
+  struct {
+    unsigned int ttl_min;
+    unsigned int ttl_max;
+    int          windows;
+  } scenarios[] = {{0, 0, 2}, {0, 5, 12}, {300, 300, 2}};
+  for (size_t names : BenchSizes({1000, 10000})) {
+    for (const auto &scenario : scenarios) {
+      LoadZone zone("first.com", scenario.ttl_min, scenario.ttl_max);
+      server_.SetZone(&zone);
+      LoadOptions opts;
+      opts.names       = names;
+      opts.duration_ms = 500;
+      LoadGenerator gen(opts, "first.com");
+
+      CountingAllocator allocator;
+      ares_channel_t *channel = NewChannel();
+      long long live = CountingAllocator::counts().live_bytes_;
+      for (int window = 0; window < scenario.windows; window++) {
+        LoadResult result = gen.Run(channel, this);
+        EXPECT_EQ(0ULL, result.failed_);
+        BenchRecord record("TTLChurn");
+        record.Set("names", names)
+          .Set("ttl", std::to_string(scenario.ttl_min) + "-" +
+                      std::to_string(scenario.ttl_max))
+          .Set("window", window)
+          .Set("elapsed_ms", (window + 1) * opts.duration_ms)
+          .Set("live_growth_kb",
+               (double)(CountingAllocator::counts().live_bytes_ - live) / 1024.0)
+          // In window 0 these include each name's first fetch; after that
+          // they are refetches of expired or uncached entries.
+          .Set("misses", result.completed_ - result.hits_);
+        result.Report(record).Report();
+      }
+      ares_destroy(channel);
+      server_.SetZone(&zone_);
+    }
+  }
+}
+
+// Every name exists but has no records of any type.
+class NoDataZone : public MockZone {
+protected:
+  int Records(const std::string &name, int rrtype,
+              std::vector<byte> *reply) const override
+  {
+    (void)name;
+    (void)rrtype;
+    (void)reply;
+    return 0;
+  }
+};
+
+// Relative names that do not resolve, looked up through ares_search() with
+// the three search domains MockChannelOptsTest configures, so each lookup
+// fans out to four queries unless the negative answers are cached.
+TEST_F(QueryCacheBenchTest, NegativeSearch) {
+  for (const char *kind : {"nxdomain", "nodata"}) {
+    for (bool soa : {false, true}) {
+      MockZone  nxdomain;
+      NoDataZone nodata;
+      MockZone &zone = (strcmp(kind, "nxdomain") == 0) ? nxdomain : nodata;
+      if (soa) {
+        for (const char *apex : {"first.com", "second.org", "third.gov", ""}) {
+          zone.AddSOA(new DNSSoaRR(apex, 300, "ns1.first.com", "hostmaster.first.com",
+                                   1, 3600, 600, 86400, 60));
+        }
+      }
+      server_.SetZone(&zone);
+
+      LoadOptions opts;
+      opts.api         = "search";
+      opts.names       = 1000;
+      opts.duration_ms = 500;
+      LoadGenerator gen(opts, "first.com");
+      ares_channel_t *channel = NewChannel();
+      for (const char *phase : {"warm", "steady"}) {
+        unsigned long long requests = server_.requests();
+        LoadResult result = gen.Run(channel, this);
+        requests = server_.requests() - requests;
+        EXPECT_EQ(result.completed_, result.failed_);
+
+        BenchRecord record("NegativeSearch");
+        record.Set("answer", kind)
+          .Set("soa", soa ? "yes" : "no")
+          .Set("names", opts.names)
+          .Set("phase", phase)
+          .Set("upstream_per_lookup",
+               (double)requests / (double)(result.completed_ ? result.completed_ : 1));
+        result.Report(record).Report();
+      }
+      ares_destroy(channel);
+      server_.SetZone(&zone_);
+    }
+  }
+}
@@ -0,0 +1,173 @@
+// Benchmarks for changing the server list of a live channel, as a daemon
+// does when it picks up a new resolver configuration without restarting.
+
+#include "ares-load.h"
+
+// Large enough for the answers to thousands of queries at once.
+static struct ares_options *ServerSwapOptions()
+{
+  static struct ares_options opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.socket_receive_buffer_size = 4 * 1024 * 1024;
+  return &opts;
+}
+
+// Four mock servers, used as two sets of two that the channel is moved
+// between while it is under load.
+class ServerSwapBenchTest : public MockChannelOptsTest {
+public:
+  ServerSwapBenchTest()
+    : MockChannelOptsTest(4, AF_INET, false, ServerSwapOptions(),
+                          ARES_OPT_SOCK_RCVBUF),
+      zone_("first.com", 0, 0), issued_(0), completed_(0), failed_(0),
+      duplicates_(0)
+  {
+    for (size_t i = 0; i < servers_.size(); i++)
+      servers_[i]->SetZone(&zone_);
+    for (size_t set = 0; set < 2; set++) {
+      char csv[64];
+      snprintf(csv, sizeof(csv), "127.0.0.1:%u,127.0.0.1:%u",
+               (unsigned)servers_[2 * set]->udpport(),
+               (unsigned)servers_[2 * set + 1]->udpport());
+      sets_[set] = csv;
+    }
+  }
+
+  unsigned long long Requests() const
+  {
+    unsigned long long total = 0;
+    for (const auto &server : servers_)
+      total += server->requests();
+    return total;
+  }
+
+  struct Query {
+    ServerSwapBenchTest *test_;
+    bool                 pending_;
+    // Time of the last swap while this query was pending, or 0.
+    unsigned long long   swap_ns_;
+  };
+
+  static void QueryCallback(void *data, int status, int timeouts,
+                            struct ares_addrinfo *ai)
+  {
+    (void)timeouts;
+    if (ai)
+      ares_freeaddrinfo(ai);
+    Query               *query = reinterpret_cast<Query *>(data);
+    ServerSwapBenchTest *test  = query->test_;
+    if (!query->pending_) {
+      test->duplicates_++;
+      return;
+    }
+    query->pending_ = false;
+    if (status != ARES_SUCCESS)
+      test->failed_++;
+    if (query->swap_ns_ != 0)
+      test->requeue_.Add(BenchNowNs() - query->swap_ns_);
+    test->completed_++;
+    test->ready_.push_back(query);
+  }
+
+  void Issue(Query *query)
+  {
+    char name[64];
+    snprintf(name, sizeof(name), "host%llu.first.com", issued_++);
+    struct ares_addrinfo_hints hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_flags  = ARES_AI_NOSORT;
+    query->pending_ = true;
+    query->swap_ns_ = 0;
+    ares_getaddrinfo(channel_, name, NULL, &hints, QueryCallback, query);
+  }
+
+protected:
+  LoadZone                 zone_;
+  std::string              sets_[2];
+  std::vector<Query *>     ready_;
+  unsigned long long       issued_;
+  unsigned long long       completed_;
+  unsigned long long       failed_;
+  unsigned long long       duplicates_;
+  LatencyHistogram         requeue_;
+};
+
+// Keeps inflight queries outstanding for a fixed time, moving the channel
+// to the other server set every interval.  Each swap blocks the caller's
+// event loop for as long as the call takes; queries that were pending at a
+// swap are timed from the swap to their answer.
+TEST_F(ServerSwapBenchTest, SwapUnderLoad) {
+  const unsigned long long duration_ns = 1000000000ULL;
+  for (size_t inflight : BenchSizes({100, 1000, 5000})) {
+    for (unsigned int interval_ms : {10, 100}) {
+      issued_ = completed_ = failed_ = duplicates_ = 0;
+      requeue_ = LatencyHistogram();
+      ready_.clear();
+      EXPECT_EQ(ARES_SUCCESS, ares_set_servers_ports_csv(channel_, sets_[0].c_str()));
+
+      unsigned long long requests = Requests();
+      std::vector<Query> queries(inflight);
+      for (Query &query : queries) {
+        query.test_ = this;
+        Issue(&query);
+      }
+      LatencyHistogram   stall;
+      size_t             set   = 0;
+      unsigned long long begin = BenchNowNs();
+      unsigned long long next_swap = begin + interval_ms * 1000000ULL;
+      unsigned long long now;
+      while ((now = BenchNowNs()) - begin < duration_ns) {
+        if (now >= next_swap) {
+          for (Query &query : queries) {
+            if (query.pending_)
+              query.swap_ns_ = now;
+          }
+          set = 1 - set;
+          EXPECT_EQ(ARES_SUCCESS, ares_set_servers_ports_csv(channel_, sets_[set].c_str()));
+          stall.Add(BenchNowNs() - now);
+          next_swap += interval_ms * 1000000ULL;
+        }
+        struct timeval tv = {0, 1000};
+        ProcessStep(channel_, this, &tv);
+        std::vector<Query *> ready;
+        ready.swap(ready_);
+        for (Query *query : ready)
+          Issue(query);
+      }
+      // Drain without reissuing, so every query is accounted for.
+      ProcessWork(channel_, this);
+      ready_.clear();
+      requests = Requests() - requests;
+      size_t lost = 0;
+      for (const Query &query : queries) {
+        if (query.pending_)
+          lost++;
+      }
+
+      // Every query gets exactly one callback.  It may still fail: each
+      // requeue uses up one of the query's tries, so swapping faster than
+      // queries complete makes them run out.
+      EXPECT_EQ(0ULL, duplicates_);
+      EXPECT_EQ((size_t)0, lost);
+      BenchRecord("ServerSwap")
+        .Set("inflight", inflight)
+        .Set("interval_ms", interval_ms)
+        .Set("swaps", stall.count())
+        .Set("completed", completed_)
+        .Set("failed", failed_)
+        .Set("lost", lost)
+        .Set("duplicate_callbacks", duplicates_)
+        // Queries sent to a server more than once, mostly requeued after
+        // their server was removed.
+        .Set("resent", requests > issued_ ? requests - issued_ : 0ULL)
+        .Set("qps", (double)completed_ * 1e9 / (double)duration_ns)
+        .Set("stall_p50_us", (double)stall.Percentile(50) / 1e3)
+        .Set("stall_max_us", (double)stall.max() / 1e3)
+        .Set("requeued", requeue_.count())
+        .Set("requeue_p50_us", (double)requeue_.Percentile(50) / 1e3)
+        .Set("requeue_p99_us", (double)requeue_.Percentile(99) / 1e3)
+        .Set("requeue_max_us", (double)requeue_.max() / 1e3)
+        .Report();
+    }
+  }
+}
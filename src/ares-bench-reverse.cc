@@ -0,0 +1,57 @@
+// Benchmarks for reverse lookups with ares_gethostbyaddr() and
+// ares_getnameinfo(), which build an in-addr.arpa or ip6.arpa name for every
+// query and parse a PTR answer rather than an address.
+
+#include "ares-load.h"
+
+// DNS only, so the hosts file is never consulted for an address.
+static struct ares_options *ReverseLookupOptions()
+{
+  static struct ares_options opts;
+  static char                lookups[] = "b";
+  memset(&opts, 0, sizeof(opts));
+  opts.lookups = lookups;
+  return &opts;
+}
+
+class ReverseLookupBenchTest : public MockChannelOptsTest {
+public:
+  ReverseLookupBenchTest()
+    : MockChannelOptsTest(1, AF_INET, false, ReverseLookupOptions(),
+                          ARES_OPT_LOOKUPS),
+      // TTL of zero keeps every answer out of the query cache.
+      zone_("first.com", 0, 0)
+  {
+    server_.SetZone(&zone_);
+  }
+
+protected:
+  LoadZone zone_;
+};
+
+// The IPv6 name is 32 labels against 4 for IPv4, so comparing the two shows
+// what building and matching the longer name costs per query.
+TEST_F(ReverseLookupBenchTest, Throughput) {
+  for (const char *api : {"gethostbyaddr", "getnameinfo"}) {
+    for (int family : {AF_INET, AF_INET6}) {
+      for (size_t outstanding : BenchSizes({1, 100, 1000})) {
+        LoadOptions opts;
+        opts.api         = api;
+        opts.family      = family;
+        opts.outstanding = outstanding;
+        opts.names       = 1000;
+        opts.duration_ms = 500;
+        LoadGenerator gen(opts, "first.com");
+        LoadResult result = gen.Run(channel_, this);
+        EXPECT_LT(0ULL, result.completed_);
+        EXPECT_EQ(0ULL, result.failed_);
+
+        BenchRecord record("ReverseLookup");
+        record.Set("api", api)
+          .Set("family", family == AF_INET ? "inet" : "inet6")
+          .Set("outstanding", outstanding);
+        result.Report(record).Report();
+      }
+    }
+  }
+}
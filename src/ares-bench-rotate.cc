@@ -0,0 +1,99 @@
+// Benchmarks for how evenly a channel spreads its queries over its servers,
+// with and without ARES_OPT_ROTATE.
+
+#include "ares-load.h"
+
+#include <algorithm>
+
+class RotateBenchTest : public MockChannelOptsTest {
+public:
+  static const size_t max_servers = 8;
+
+  RotateBenchTest()
+    : MockChannelOptsTest(max_servers, AF_INET, false, nullptr, 0),
+      zone_("first.com", 0, 0)
+  {
+    for (const auto &server : servers_)
+      server->SetZone(&zone_);
+  }
+
+  // A channel on the first count mock servers.
+  ares_channel_t *RotateChannel(size_t count, bool rotate)
+  {
+    struct ares_options opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.timeout = 1500;
+    opts.tries   = 3;
+    ares_channel_t *channel = nullptr;
+    EXPECT_EQ(ARES_SUCCESS,
+              ares_init_options(&channel, &opts,
+                                ARES_OPT_TIMEOUTMS | ARES_OPT_TRIES |
+                                (rotate ? ARES_OPT_ROTATE : ARES_OPT_NOROTATE)));
+    if (channel == nullptr)
+      return nullptr;
+    std::string csv;
+    for (size_t i = 0; i < count; i++) {
+      if (!csv.empty())
+        csv += ",";
+      csv += "127.0.0.1:" + std::to_string(servers_[i]->udpport());
+    }
+    EXPECT_EQ(ARES_SUCCESS, ares_set_servers_ports_csv(channel, csv.c_str()));
+    return channel;
+  }
+
+protected:
+  LoadZone zone_;
+};
+
+// Closed loop load over 2 to 8 healthy servers.  Reports each server's
+// share of the requests and Jain's fairness index over them, which is 1
+// when every server gets the same share and 1/N when one server gets all
+// of it.
+TEST_F(RotateBenchTest, Distribution) {
+  for (bool rotate : {false, true}) {
+    for (size_t count : {2, 4, 8}) {
+      ares_channel_t *channel = RotateChannel(count, rotate);
+      ASSERT_NE(nullptr, channel);
+      std::vector<unsigned long> before;
+      for (size_t i = 0; i < count; i++)
+        before.push_back(servers_[i]->requests());
+
+      LoadOptions opts;
+      opts.outstanding = 100;
+      opts.duration_ms = 300;
+      LoadGenerator gen(opts, "first.com");
+      LoadResult result = gen.Run(channel, this);
+      ares_destroy(channel);
+      EXPECT_EQ(0ULL, result.failed_);
+
+      double      total = 0, squares = 0, low = 1, high = 0;
+      std::string shares;
+      std::vector<double> sent;
+      for (size_t i = 0; i < count; i++) {
+        sent.push_back((double)(servers_[i]->requests() - before[i]));
+        total += sent.back();
+        squares += sent.back() * sent.back();
+      }
+      for (size_t i = 0; i < count; i++) {
+        double share = total > 0 ? sent[i] / total : 0;
+        low  = std::min(low, share);
+        high = std::max(high, share);
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%s%.3f", i ? "/" : "", share);
+        shares += buf;
+      }
+      // RotateMultiMockTestAI.SpreadsLoad checks the spread; this only
+      // reports it.
+      double fairness = squares > 0 ? total * total / ((double)count * squares) : 0;
+
+      BenchRecord record("RotateDistribution");
+      record.Set("rotate", rotate ? "yes" : "no")
+        .Set("servers", count)
+        .Set("shares", shares)
+        .Set("share_min", low)
+        .Set("share_max", high)
+        .Set("fairness", fairness);
+      result.Report(record).Report();
+    }
+  }
+}
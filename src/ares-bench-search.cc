@@ -0,0 +1,158 @@
+// Benchmarks for search list expansion: how many queries a lookup of a
+// relative name sends, and how long it takes, as ndots and the number of
+// search domains grow (as with the ndots:5 and long search lists that
+// Kubernetes pods get by default).
+
+#include "ares-load.h"
+
+class SearchExpansionBenchTest : public MockChannelOptsTest {
+public:
+  SearchExpansionBenchTest() : MockChannelOptsTest(1, AF_INET, false, nullptr, 0)
+  {
+  }
+
+  // A channel on the mock server with the given ndots and search list.
+  // DNS only, so the hosts file is not read for each candidate name.
+  ares_channel_t *SearchChannel(int ndots, const std::vector<std::string> &domains)
+  {
+    std::vector<char *> list;
+    for (const std::string &domain : domains)
+      list.push_back(const_cast<char *>(domain.c_str()));
+    static char lookups[] = "b";
+    struct ares_options opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.ndots    = ndots;
+    opts.domains  = list.data();
+    opts.ndomains = (int)list.size();
+    opts.lookups  = lookups;
+    opts.timeout  = 1500;
+    opts.tries    = 3;
+    ares_channel_t *channel = nullptr;
+    EXPECT_EQ(ARES_SUCCESS,
+              ares_init_options(&channel, &opts,
+                                ARES_OPT_NDOTS | ARES_OPT_DOMAINS | ARES_OPT_LOOKUPS |
+                                ARES_OPT_TIMEOUTMS | ARES_OPT_TRIES));
+    if (channel == nullptr)
+      return nullptr;
+
+    // Only UDP is used, as no answer here is big enough to be truncated.
+    char server[64];
+    snprintf(server, sizeof(server), "127.0.0.1:%u", (unsigned)server_.udpport());
+    EXPECT_EQ(ARES_SUCCESS, ares_set_servers_ports_csv(channel, server));
+    return channel;
+  }
+
+  struct Lookup {
+    LatencyHistogram  *latency_;
+    unsigned long long issued_ns_;
+    int                status_;
+  };
+
+  static void LookupCallback(void *data, int status, int timeouts,
+                             struct ares_addrinfo *ai)
+  {
+    (void)timeouts;
+    if (ai)
+      ares_freeaddrinfo(ai);
+    Lookup *lookup  = reinterpret_cast<Lookup *>(data);
+    lookup->status_ = status;
+    lookup->latency_->Add(BenchNowNs() - lookup->issued_ns_);
+  }
+};
+
+// Names with dots just under and at ndots, for the default of 1, for 2,
+// and for the ndots:5 of Kubernetes: at or over ndots the name is tried as
+// given first, and under it the search list is walked first.  The zone
+// answers under the first search domain, under the last one, only for the
+// name as given ("absolute", an external name), or not at all.
+TEST_F(SearchExpansionBenchTest, NDots) {
+  const size_t lookups = 100;
+  // Labels for the name as given, taken from the end.
+  const char *labels[] = {"a", "b", "c", "svc", "ns"};
+  const int   nlabels  = (int)(sizeof(labels) / sizeof(labels[0]));
+  struct {
+    int ndots;
+    int dots;
+  } cases[] = {{1, 1}, {2, 1}, {2, 2}, {5, 4}, {5, 5}};
+  struct ares_addrinfo_hints hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_flags  = ARES_AI_NOSORT;
+
+  for (size_t ndomains : {0, 1, 2, 4, 8, 16, 32}) {
+    std::vector<std::string> domains;
+    char name[64];
+    for (size_t i = 0; i < ndomains; i++) {
+      snprintf(name, sizeof(name), "d%zu.search.test", i);
+      domains.push_back(name);
+    }
+    for (const char *hit : {"first", "last", "absolute", "none"}) {
+      if (ndomains == 0 && (strcmp(hit, "first") == 0 || strcmp(hit, "last") == 0))
+        continue;
+      for (const auto &c : cases) {
+        std::string tail;
+        for (int i = nlabels - c.dots; i < nlabels; i++)
+          tail = tail + "." + labels[i];
+        std::string suffix;
+        if (strcmp(hit, "first") == 0) {
+          suffix = domains.front();
+        } else if (strcmp(hit, "last") == 0) {
+          suffix = domains.back();
+        } else if (strcmp(hit, "absolute") == 0) {
+          suffix = tail.substr(1);
+        } else {
+          suffix = "nowhere.invalid";
+        }
+        LoadZone zone(suffix, 0, 0);
+        server_.SetZone(&zone);
+
+        ares_channel_t *channel = SearchChannel(c.ndots, domains);
+        ASSERT_NE(nullptr, channel);
+        LatencyHistogram latency;
+        std::vector<Lookup> pending(lookups);
+        unsigned long long requests = server_.requests();
+        unsigned long long begin = BenchNowNs();
+        for (size_t i = 0; i < lookups; i++) {
+          snprintf(name, sizeof(name), "host%zu%s", i, tail.c_str());
+          pending[i].latency_   = &latency;
+          pending[i].issued_ns_ = BenchNowNs();
+          pending[i].status_    = -1;
+          ares_getaddrinfo(channel, name, NULL, &hints, LookupCallback, &pending[i]);
+        }
+        ProcessChannels({channel}, this);
+        unsigned long long elapsed_ns = BenchNowNs() - begin;
+        requests = server_.requests() - requests;
+        ares_destroy(channel);
+        server_.SetZone(nullptr);
+
+        // The name as given is tried first or last, and the search domains
+        // in order either side of it, stopping at the first answer.
+        bool   as_is_first = ndomains == 0 || c.dots >= c.ndots;
+        size_t expected;
+        if (strcmp(hit, "first") == 0) {
+          expected = as_is_first ? 2 : 1;
+        } else if (strcmp(hit, "last") == 0) {
+          expected = as_is_first ? ndomains + 1 : ndomains;
+        } else if (strcmp(hit, "absolute") == 0) {
+          expected = as_is_first ? 1 : ndomains + 1;
+        } else {
+          expected = ndomains + 1;
+        }
+        int want = (strcmp(hit, "none") == 0) ? ARES_ENOTFOUND : ARES_SUCCESS;
+        for (const Lookup &lookup : pending)
+          EXPECT_EQ(want, lookup.status_);
+        EXPECT_EQ(expected * lookups, requests);
+
+        BenchRecord("SearchExpansion")
+          .Set("ndots", c.ndots)
+          .Set("dots", c.dots)
+          .Set("domains", ndomains)
+          .Set("hit", hit)
+          .Set("queries_per_lookup", (double)requests / (double)lookups)
+          .Set("us_per_lookup", (double)elapsed_ns / 1e3 / (double)lookups)
+          .Set("p50_us", (double)latency.Percentile(50) / 1e3)
+          .Set("p99_us", (double)latency.Percentile(99) / 1e3)
+          .Report();
+      }
+    }
+  }
+}
@@ -0,0 +1,111 @@
+// Benchmarks for RFC 6724 sorting of ares_getaddrinfo() results, which
+// finds the source address for every destination by connecting a UDP
+// socket to it.
+
+#include "ares-load.h"
+
+class AddressSortBenchTest : public MockChannelOptsTest {
+public:
+  AddressSortBenchTest() : MockChannelOptsTest(1, AF_INET, false, nullptr, 0)
+  {
+    // A mix of scopes in each family, so that sorting has to reorder them.
+    for (size_t count : sizes()) {
+      std::string name = Name(count);
+      for (size_t i = 0; i < count; i++) {
+        byte n = (byte)(i / 2);
+        if (i % 2 == 0) {
+          switch (n % 3) {
+            case 0:
+              zone_.Add(new DNSARR(name, 300, {10, 0, 0, n}));
+              break;
+            case 1:
+              zone_.Add(new DNSARR(name, 300, {192, 0, 2, n}));
+              break;
+            default:
+              zone_.Add(new DNSARR(name, 300, {127, 0, 0, n}));
+              break;
+          }
+        } else {
+          byte prefix = (n % 3 == 0) ? 0x20 : (n % 3 == 1) ? 0xfd : 0xfe;
+          zone_.Add(new DNSAaaaRR(name, 300, {prefix, (byte)(prefix == 0x20 ? 0x01 : 0x80),
+                                              0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, n}));
+        }
+      }
+    }
+    server_.SetZone(&zone_);
+  }
+
+  static std::vector<size_t> sizes()
+  {
+    return {1, 2, 4, 8, 16, 32, 64, 128, 256};
+  }
+
+  static std::string Name(size_t count)
+  {
+    return "n" + std::to_string(count) + ".example.com";
+  }
+
+  static void LookupCallback(void *data, int status, int timeouts,
+                             struct ares_addrinfo *ai)
+  {
+    (void)timeouts;
+    size_t count = 0;
+    if (ai) {
+      for (struct ares_addrinfo_node *node = ai->nodes; node; node = node->ai_next)
+        count++;
+      ares_freeaddrinfo(ai);
+    }
+    *reinterpret_cast<size_t *>(data) = (status == ARES_SUCCESS) ? count : 0;
+  }
+
+protected:
+  MockZone zone_;
+};
+
+// Answers come from the query cache after the first lookup, so the time
+// per lookup is parsing, building the result and (if enabled) sorting it,
+// with no network round trip.
+TEST_F(AddressSortBenchTest, SortCost) {
+  const size_t lookups = 200;
+  for (size_t count : sizes()) {
+    for (bool sort : {false, true}) {
+      SyscallCounter  syscalls;
+      ares_channel_t *channel = NewChannel();
+      ASSERT_NE(nullptr, channel);
+      syscalls.Install(channel);
+
+      struct ares_addrinfo_hints hints = {};
+      hints.ai_family = AF_UNSPEC;
+      hints.ai_flags  = sort ? 0 : ARES_AI_NOSORT;
+      std::string name = Name(count);
+      size_t      returned = 0;
+      ares_getaddrinfo(channel, name.c_str(), NULL, &hints, LookupCallback, &returned);
+      ProcessWork(channel, this);
+      EXPECT_EQ(count, returned);
+
+      SyscallCounter warm = syscalls;
+      unsigned long long begin = BenchNowNs();
+      for (size_t i = 0; i < lookups; i++) {
+        returned = 0;
+        ares_getaddrinfo(channel, name.c_str(), NULL, &hints, LookupCallback, &returned);
+      }
+      unsigned long long elapsed_ns = BenchNowNs() - begin;
+      EXPECT_EQ(count, returned);
+      ares_destroy(channel);
+      // Sorting probes every address with a socket of its own.
+      EXPECT_EQ(sort ? count * lookups : 0, syscalls.sockets_ - warm.sockets_);
+
+      double per_lookup = 1.0 / (double)lookups;
+      BenchRecord("AddressSort")
+        .Set("addresses", count)
+        .Set("sort", sort ? "yes" : "no")
+        .Set("us_per_lookup", (double)elapsed_ns / 1e3 * per_lookup)
+        .Set("sockets_per_lookup", (double)(syscalls.sockets_ - warm.sockets_) * per_lookup)
+        .Set("connects_per_lookup", (double)(syscalls.connects_ - warm.connects_) * per_lookup)
+        .Set("getsocknames_per_lookup",
+             (double)(syscalls.getsocknames_ - warm.getsocknames_) * per_lookup)
+        .Set("syscalls_per_lookup", (double)(syscalls.total() - warm.total()) * per_lookup)
+        .Report();
+    }
+  }
+}
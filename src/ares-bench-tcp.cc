@@ -0,0 +1,148 @@
+// Benchmarks for lookups over TCP (ARES_FLAG_USEVC): how many queries each
+// connection carries, and what opening a new one costs the lookup that has
+// to wait for it.
+
+#include "ares-load.h"
+
+class TcpChurnBenchTest : public MockChannelOptsTest {
+public:
+  TcpChurnBenchTest()
+    : MockChannelOptsTest(1, AF_INET, false, nullptr, 0),
+      zone_("first.com", 0, 0), lookups_(0)
+  {
+    server_.SetZone(&zone_);
+  }
+
+  // A channel on the mock server over UDP, or over TCP with or without
+  // ARES_FLAG_STAYOPEN.
+  ares_channel_t *TransportChannel(bool tcp, bool stayopen)
+  {
+    struct ares_options opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.flags = (tcp ? ARES_FLAG_USEVC : 0) | (stayopen ? ARES_FLAG_STAYOPEN : 0);
+    ares_channel_t *channel = nullptr;
+    EXPECT_EQ(ARES_SUCCESS, ares_init_options(&channel, &opts, ARES_OPT_FLAGS));
+    if (channel == nullptr)
+      return nullptr;
+    std::string csv = "127.0.0.1:" +
+                      std::to_string(tcp ? server_.tcpport() : server_.udpport());
+    EXPECT_EQ(ARES_SUCCESS, ares_set_servers_ports_csv(channel, csv.c_str()));
+    return channel;
+  }
+
+  static void ResolveCallback(void *data, int status, int timeouts,
+                              struct ares_addrinfo *ai)
+  {
+    (void)timeouts;
+    if (ai)
+      ares_freeaddrinfo(ai);
+    *reinterpret_cast<int *>(data) = status;
+  }
+
+  // Resolve batch new names at once and wait for all of them.  Returns the
+  // number that failed.
+  size_t Resolve(ares_channel_t *channel, size_t batch)
+  {
+    std::vector<int> status(batch, -1);
+    struct ares_addrinfo_hints hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_flags  = ARES_AI_NOSORT;
+    for (size_t i = 0; i < batch; i++) {
+      char name[64];
+      snprintf(name, sizeof(name), "host%zu.first.com", lookups_++);
+      ares_getaddrinfo(channel, name, NULL, &hints, ResolveCallback, &status[i]);
+    }
+    ProcessWork(channel, this);
+    size_t failed = 0;
+    for (int s : status) {
+      if (s != ARES_SUCCESS)
+        failed++;
+    }
+    return failed;
+  }
+
+protected:
+  LoadZone zone_;
+  size_t   lookups_;
+};
+
+// Lookups one after another, or in batches issued together, with the
+// server dropping its TCP connections every close_every queries to mimic
+// an upstream with an idle or request limit.  Latency is split between the
+// batches that had to connect first and those that went out on an open
+// connection.
+TEST_F(TcpChurnBenchTest, ConnectionReuse) {
+  const size_t lookups = 1000;
+  struct Transport {
+    const char *name;
+    bool        tcp;
+    bool        stayopen;
+  };
+  const Transport transports[] = {
+    {"udp", false, false},
+    {"tcp", true, false},
+    {"tcp_stayopen", true, true},
+  };
+  for (const Transport &transport : transports) {
+    for (size_t batch : {1, 10}) {
+      for (size_t close_every : {0, 100, 10, 1}) {
+        // Without ARES_FLAG_STAYOPEN connections are closed whenever they
+        // go idle, so server closes change nothing; and closing more often
+        // than once a batch is the same as once a batch.
+        if (close_every != 0 && (!transport.stayopen || close_every < batch))
+          continue;
+        SyscallCounter  syscalls;
+        ares_channel_t *channel = TransportChannel(transport.tcp, transport.stayopen);
+        ASSERT_NE(nullptr, channel);
+        syscalls.Install(channel);
+
+        LatencyHistogram connecting, reusing;
+        size_t           failed = 0;
+        unsigned long    requests = server_.requests();
+        for (size_t i = 0; i < lookups / batch; i++) {
+          if (close_every != 0 && i != 0 && (i * batch) % close_every < batch)
+            server_.Disconnect();
+          unsigned long long connects = syscalls.connects_;
+          unsigned long long begin = BenchNowNs();
+          failed += Resolve(channel, batch);
+          unsigned long long ns = BenchNowNs() - begin;
+          if (syscalls.connects_ != connects)
+            connecting.Add(ns);
+          else
+            reusing.Add(ns);
+        }
+        requests = server_.requests() - requests;
+        ares_destroy(channel);
+        server_.Disconnect();
+
+        EXPECT_EQ(0U, failed);
+        if (transport.stayopen && close_every == 0) {
+          EXPECT_EQ(1ULL, syscalls.connects_);
+        } else if (transport.tcp && !transport.stayopen) {
+          // Without ARES_FLAG_STAYOPEN the connection is closed as soon as
+          // it is idle, so no batch ever finds one open.
+          EXPECT_EQ(lookups / batch, syscalls.connects_);
+        }
+
+        double per_query = requests ? 1.0 / (double)requests : 0;
+        BenchRecord("TcpChurn")
+          .Set("transport", transport.name)
+          .Set("batch", batch)
+          .Set("close_every", close_every)
+          .Set("queries", (unsigned long long)requests)
+          .Set("failed", failed)
+          .Set("connects", syscalls.connects_)
+          .Set("closes", syscalls.closes_)
+          .Set("queries_per_conn",
+               syscalls.connects_ ? (double)requests / (double)syscalls.connects_ : 0)
+          .Set("sends_per_query", (double)syscalls.sends_ * per_query)
+          .Set("recvs_per_query", (double)syscalls.recvs_ * per_query)
+          .Set("syscalls_per_query", (double)syscalls.total() * per_query)
+          .Set("connect_batches", connecting.count())
+          .Set("connect_p50_us", (double)connecting.Percentile(50) / 1e3)
+          .Set("reuse_p50_us", (double)reusing.Percentile(50) / 1e3)
+          .Report();
+      }
+    }
+  }
+}
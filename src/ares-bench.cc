@@ -0,0 +1,229 @@
+#include "ares-bench.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+size_t      bench_max_n = 100000;
+std::string bench_impl;
+bool        bench_perf = false;
+
+std::vector<size_t> BenchSizes(const std::vector<size_t> &sizes) {
+  std::vector<size_t> result;
+  for (size_t size : sizes) {
+    if (size <= bench_max_n)
+      result.push_back(size);
+  }
+  return result;
+}
+
+unsigned long long BenchNowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+unsigned long long BenchCpuNs() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ((unsigned long long)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL) +
+         ((unsigned long long)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL);
+}
+
+size_t BenchOpenFDs() {
+  size_t count = 0;
+  DIR   *dir   = opendir("/proc/self/fd");
+  if (!dir)
+    return 0;
+  while (struct dirent *entry = readdir(dir)) {
+    if (entry->d_name[0] != '.')
+      count++;
+  }
+  closedir(dir);
+  // Don't count the descriptor used to read the directory.
+  return count - 1;
+}
+
+BenchRecord::BenchRecord(const std::string &name) : name_(name) {
+}
+
+BenchRecord &BenchRecord::Set(const std::string &key, const std::string &value) {
+  values_.push_back(std::make_pair(key, value));
+  return *this;
+}
+
+BenchRecord &BenchRecord::Set(const std::string &key, const char *value) {
+  return Set(key, std::string(value));
+}
+
+BenchRecord &BenchRecord::Set(const std::string &key, double value) {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(value < 10.0 ? 4 : 1) << value;
+  return Set(key, ss.str());
+}
+
+BenchRecord &BenchRecord::Set(const std::string &key, unsigned long long value) {
+  return Set(key, std::to_string(value));
+}
+
+void BenchRecord::Report() const {
+  std::stringstream ss;
+  ss << "[ BENCH    ] " << name_ << " impl=" << bench_impl;
+  for (const auto &value : values_) {
+    ss << " " << value.first << "=" << value.second;
+  }
+  std::cout << ss.str() << std::endl;
+}
+
+// 128 exact buckets, then 64 per power of two for the remaining bits.
+static const size_t kExactBuckets = 128;
+static const size_t kSubBuckets   = 64;
+static const size_t kBuckets      = kExactBuckets + (64 - 7) * kSubBuckets;
+
+LatencyHistogram::LatencyHistogram()
+  : buckets_(kBuckets, 0), count_(0), sum_(0), max_(0) {
+}
+
+size_t LatencyHistogram::Bucket(unsigned long long ns) {
+  if (ns < kExactBuckets)
+    return (size_t)ns;
+  int msb   = 63 - __builtin_clzll(ns);
+  int shift = msb - 6;
+  return kExactBuckets + (size_t)(shift - 1) * kSubBuckets +
+         (size_t)((ns >> shift) - kSubBuckets);
+}
+
+unsigned long long LatencyHistogram::BucketMax(size_t bucket) {
+  if (bucket < kExactBuckets)
+    return bucket;
+  size_t             shift = (bucket - kExactBuckets) / kSubBuckets + 1;
+  unsigned long long sub   = (bucket - kExactBuckets) % kSubBuckets + kSubBuckets;
+  return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Add(unsigned long long ns) {
+  buckets_[Bucket(ns)]++;
+  count_++;
+  sum_ += ns;
+  if (ns > max_)
+    max_ = ns;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram &other) {
+  for (size_t i = 0; i < kBuckets; i++)
+    buckets_[i] += other.buckets_[i];
+  count_ += other.count_;
+  sum_ += other.sum_;
+  if (other.max_ > max_)
+    max_ = other.max_;
+}
+
+unsigned long long LatencyHistogram::Percentile(double pct) const {
+  if (count_ == 0)
+    return 0;
+  unsigned long long target = (unsigned long long)((pct / 100.0) * (double)count_ + 0.5);
+  if (target < 1)
+    target = 1;
+  unsigned long long seen = 0;
+  for (size_t i = 0; i < kBuckets; i++) {
+    seen += buckets_[i];
+    if (seen >= target)
+      return std::min(BucketMax(i), max_);
+  }
+  return max_;
+}
+
+static const struct {
+  const char *name;
+  __u32       type;
+  __u64       config;
+} kPerfEvents[PerfCounters::kEvents] = {
+  {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  {"l1d_misses", PERF_TYPE_HW_CACHE,
+   PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+  {"llc_misses", PERF_TYPE_HW_CACHE,
+   PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+PerfCounters::PerfCounters() {
+  static bool warned = false;
+  size_t      opened = 0;
+  for (int i = 0; i < kEvents; i++) {
+    fds_[i]    = -1;
+    values_[i] = 0;
+    if (!bench_perf)
+      continue;
+    // Each event on its own rather than as a group, so that one the CPU
+    // lacks does not take the others with it.  If the kernel has to
+    // multiplex them, the counts are scaled up to the time enabled.
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = kPerfEvents[i].type;
+    attr.config         = kPerfEvents[i].config;
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv     = 1;
+    attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    fds_[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    if (fds_[i] >= 0)
+      opened++;
+  }
+  if (bench_perf && opened == 0 && !warned) {
+    std::cerr << "perf_event_open: no hardware counters available" << std::endl;
+    warned = true;
+  }
+}
+
+PerfCounters::~PerfCounters() {
+  for (int i = 0; i < kEvents; i++) {
+    if (fds_[i] >= 0)
+      close(fds_[i]);
+  }
+}
+
+void PerfCounters::Start() {
+  for (int i = 0; i < kEvents; i++) {
+    if (fds_[i] < 0)
+      continue;
+    ioctl(fds_[i], PERF_EVENT_IOC_RESET, 0);
+    ioctl(fds_[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+void PerfCounters::Stop() {
+  for (int i = 0; i < kEvents; i++) {
+    if (fds_[i] >= 0)
+      ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+  }
+  for (int i = 0; i < kEvents; i++) {
+    values_[i] = 0;
+    if (fds_[i] < 0)
+      continue;
+    // value, time enabled, time running
+    unsigned long long data[3];
+    if (read(fds_[i], data, sizeof(data)) != (ssize_t)sizeof(data) || data[2] == 0)
+      continue;
+    values_[i] = (unsigned long long)((double)data[0] * (double)data[1] / (double)data[2]);
+  }
+}
+
+BenchRecord &PerfCounters::Set(BenchRecord &record, double ops) const {
+  for (int i = 0; i < kEvents; i++) {
+    if (fds_[i] >= 0)
+      record.Set(std::string(kPerfEvents[i].name) + "_per_op", (double)values_[i] / ops);
+  }
+  if (fds_[kInstructions] >= 0 && fds_[kCycles] >= 0 && values_[kCycles] != 0)
+    record.Set("ipc", (double)values_[kInstructions] / (double)values_[kCycles]);
+  return record;
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "ares-test.h"
+
+// Largest problem size the benchmarks will run, set with --bench_max=N.
+// Sizes above it are skipped so the default run stays short.
+extern size_t bench_max_n;
+
+// Filter a list of benchmark sizes down to those within bench_max_n.
+std::vector<size_t>  BenchSizes(const std::vector<size_t> &sizes);
+
+// Wall clock from CLOCK_MONOTONIC, and process CPU time (user + system).
+unsigned long long   BenchNowNs();
+unsigned long long   BenchCpuNs();
+
+// Number of open file descriptors.
+size_t               BenchOpenFDs();
+
+// Basename of the implementation under test, used to tag result lines.
+extern std::string   bench_impl;
+
+// Whether to read hardware performance counters, set with --bench_perf.
+extern bool          bench_perf;
+
+// One line of benchmark output, printed on Report() as
+//   [ BENCH    ] <name> impl=<impl> key=value ...
+class BenchRecord {
+public:
+  explicit BenchRecord(const std::string &name);
+
+  BenchRecord &Set(const std::string &key, const std::string &value);
+  BenchRecord &Set(const std::string &key, const char *value);
+  BenchRecord &Set(const std::string &key, double value);
+  BenchRecord &Set(const std::string &key, unsigned long long value);
+
+  BenchRecord &Set(const std::string &key, int value)
+  {
+    return Set(key, std::to_string(value));
+  }
+
+  BenchRecord &Set(const std::string &key, unsigned int value)
+  {
+    return Set(key, (unsigned long long)value);
+  }
+
+  BenchRecord &Set(const std::string &key, long value)
+  {
+    return Set(key, std::to_string(value));
+  }
+
+  BenchRecord &Set(const std::string &key, unsigned long value)
+  {
+    return Set(key, (unsigned long long)value);
+  }
+
+  void         Report() const;
+
+private:
+  std::string                                      name_;
+  std::vector<std::pair<std::string, std::string>> values_;
+};
+
+// Log-linear histogram of latencies in nanoseconds.  Values below 128 are
+// exact; above that each power of two is split into 64 buckets, so any
+// reported percentile is within about 1.6% of the true value.
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+
+  void               Add(unsigned long long ns);
+  void               Merge(const LatencyHistogram &other);
+
+  // Smallest recorded bucket bound such that pct percent of the values are
+  // at or below it.  Returns 0 if the histogram is empty.
+  unsigned long long Percentile(double pct) const;
+
+  unsigned long long count() const
+  {
+    return count_;
+  }
+
+  unsigned long long max() const
+  {
+    return max_;
+  }
+
+  double             mean() const
+  {
+    return count_ ? (double)sum_ / (double)count_ : 0.0;
+  }
+
+private:
+  static size_t             Bucket(unsigned long long ns);
+  static unsigned long long BucketMax(size_t bucket);
+
+  std::vector<unsigned long long> buckets_;
+  unsigned long long              count_;
+  unsigned long long              sum_;
+  unsigned long long              max_;
+};
+
+// Hardware performance counters for the calling thread, read through
+// perf_event_open(2) while between Start() and Stop(), counting user space
+// only.  Does nothing unless --bench_perf was given; events the kernel or
+// the CPU does not support are left out of the results.
+class PerfCounters {
+public:
+  enum Event {
+    kInstructions,
+    kCycles,
+    kBranchMisses,
+    kL1dMisses,
+    kLlcMisses,
+    kEvents
+  };
+
+  PerfCounters();
+  ~PerfCounters();
+
+  void         Start();
+  void         Stop();
+
+  // Add each event per op to the record, and instructions per cycle.
+  BenchRecord &Set(BenchRecord &record, double ops) const;
+
+private:
+  int                fds_[kEvents];
+  unsigned long long values_[kEvents];
+};
@@ -0,0 +1,344 @@
+#include "ares-load.h"
+#include "dns-proto.h"
+
+#include <algorithm>
+#include <math.h>
+#include <strings.h>
+
+// Most queries sent back to back when behind schedule before polling.
+static const size_t kMaxBurst = 64;
+
+LoadZone::LoadZone(const std::string &suffix, unsigned int ttl_min,
+                   unsigned int ttl_max)
+  : suffix_(suffix), ttl_min_(ttl_min), ttl_max_(ttl_max) {
+}
+
+unsigned int LoadZone::Hash(const std::string &name) {
+  // FNV-1a, ignoring case as DNS does.
+  unsigned int hash = 2166136261u;
+  for (char c : name) {
+    hash ^= (unsigned char)tolower((unsigned char)c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+static bool HasSuffix(const std::string &name, const char *suffix, size_t len) {
+  return name.size() >= len &&
+         strcasecmp(name.c_str() + name.size() - len, suffix) == 0;
+}
+
+int LoadZone::Records(const std::string &name, int rrtype,
+                      std::vector<byte> *reply) const {
+  if (HasSuffix(name, ".in-addr.arpa", 13) || HasSuffix(name, ".ip6.arpa", 9)) {
+    if (rrtype != T_PTR) {
+      return 0;
+    }
+    unsigned int hash = Hash(name);
+    char target[32];
+    snprintf(target, sizeof(target), "host-%08x.", hash);
+    PushInt16(reply, 0xC000 | NS_HFIXEDSZ);
+    PushInt16(reply, T_PTR);
+    PushInt16(reply, C_IN);
+    PushInt32(reply, ttl_min_ + (ttl_max_ > ttl_min_ ? hash % (ttl_max_ - ttl_min_ + 1) : 0));
+    size_t rdlength = reply->size();
+    PushInt16(reply, 0);
+    PushName(reply, target + suffix_);
+    size_t len = reply->size() - rdlength - 2;
+    (*reply)[rdlength]     = (byte)(len >> 8);
+    (*reply)[rdlength + 1] = (byte)len;
+    return 1;
+  }
+  if (!HasSuffix(name, suffix_.c_str(), suffix_.size())) {
+    return -1;
+  }
+  if (rrtype != T_A && rrtype != T_AAAA) {
+    return 0;
+  }
+
+  unsigned int hash = Hash(name);
+  unsigned int ttl  = ttl_min_ + (ttl_max_ > ttl_min_ ? hash % (ttl_max_ - ttl_min_ + 1) : 0);
+  // The owner name is a pointer back to the question at offset 12.
+  PushInt16(reply, 0xC000 | NS_HFIXEDSZ);
+  PushInt16(reply, rrtype);
+  PushInt16(reply, C_IN);
+  PushInt32(reply, ttl);
+  if (rrtype == T_A) {
+    PushInt16(reply, 4);
+    reply->push_back(10);
+    reply->push_back((byte)(hash >> 16));
+    reply->push_back((byte)(hash >> 8));
+    reply->push_back((byte)hash);
+  } else {
+    PushInt16(reply, 16);
+    static const byte prefix[12] = {0xfd, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    reply->insert(reply->end(), prefix, prefix + sizeof(prefix));
+    PushInt32(reply, hash);
+  }
+  return 1;
+}
+
+BenchRecord &LoadResult::Report(BenchRecord &record) const {
+  double elapsed_s = (double)elapsed_ns_ / 1e9;
+  double completed = completed_ ? (double)completed_ : 1.0;
+  record.Set("completed", completed_)
+    .Set("failed", failed_)
+    .Set("qps", (double)completed_ / elapsed_s)
+    .Set("cpu_us_per_query", (double)cpu_ns_ / completed / 1e3)
+    .Set("server_us_per_query", (double)server_ns_ / completed / 1e3)
+    .Set("issue_us_per_query", (double)issue_ns_ / completed / 1e3)
+    .Set("library_us_per_query",
+         (double)(cpu_ns_ > server_ns_ ? cpu_ns_ - server_ns_ : 0) / completed / 1e3)
+    .Set("mean_us", latency_.mean() / 1e3)
+    .Set("p50_us", (double)latency_.Percentile(50) / 1e3)
+    .Set("p90_us", (double)latency_.Percentile(90) / 1e3)
+    .Set("p99_us", (double)latency_.Percentile(99) / 1e3)
+    .Set("p999_us", (double)latency_.Percentile(99.9) / 1e3)
+    .Set("max_us", (double)latency_.max() / 1e3)
+    .Set("hit_ratio", (double)hits_ / completed);
+  if (hits_ > 0) {
+    record.Set("hit_p50_us", (double)hit_latency_.Percentile(50) / 1e3)
+      .Set("hit_p99_us", (double)hit_latency_.Percentile(99) / 1e3)
+      .Set("miss_p50_us", (double)miss_latency_.Percentile(50) / 1e3)
+      .Set("miss_p99_us", (double)miss_latency_.Percentile(99) / 1e3);
+  }
+  if (send_lag_.count() > 0) {
+    record.Set("send_lag_p99_us", (double)send_lag_.Percentile(99) / 1e3)
+      .Set("send_lag_max_us", (double)send_lag_.max() / 1e3);
+  }
+  return record;
+}
+
+LoadGenerator::LoadGenerator(const LoadOptions &opts, const std::string &domain)
+  : opts_(opts), next_(0), rng_(0x9E3779B97F4A7C15ULL), recording_(false),
+    issuing_(false) {
+  if (opts_.api == "gethostbyaddr" || opts_.api == "getnameinfo") {
+    addrs_.resize(opts_.names);
+    for (size_t i = 0; i < opts_.names; i++)
+      Address(i, opts_.family, &addrs_[i]);
+  } else {
+    char name[64];
+    names_.reserve(opts_.names);
+    for (size_t i = 0; i < opts_.names; i++) {
+      if (opts_.api == "search") {
+        // Relative name, completed from the channel's search domains.
+        snprintf(name, sizeof(name), "host%zu", i);
+      } else {
+        snprintf(name, sizeof(name), "host%zu.%s", i, domain.c_str());
+      }
+      names_.push_back(name);
+    }
+  }
+
+  if (opts_.zipf > 0) {
+    double total = 0;
+    zipf_cdf_.resize(opts_.names);
+    for (size_t i = 0; i < opts_.names; i++) {
+      total += 1.0 / pow((double)(i + 1), opts_.zipf);
+      zipf_cdf_[i] = total;
+    }
+    for (double &p : zipf_cdf_)
+      p /= total;
+  }
+}
+
+size_t LoadGenerator::NextName() {
+  if (!zipf_cdf_.empty()) {
+    // xorshift64*, then invert the CDF.
+    rng_ ^= rng_ >> 12;
+    rng_ ^= rng_ << 25;
+    rng_ ^= rng_ >> 27;
+    double u = (double)((rng_ * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+    size_t index = (size_t)(std::upper_bound(zipf_cdf_.begin(), zipf_cdf_.end(), u) -
+                            zipf_cdf_.begin());
+    return index < opts_.names ? index : opts_.names - 1;
+  }
+  size_t index = next_++;
+  if (next_ == opts_.names)
+    next_ = 0;
+  return index;
+}
+
+void LoadGenerator::Address(size_t index, int family,
+                            struct sockaddr_storage *addr) {
+  memset(addr, 0, sizeof(*addr));
+  if (family == AF_INET || (family == AF_UNSPEC && index % 2 == 0)) {
+    struct sockaddr_in *sin = reinterpret_cast<struct sockaddr_in *>(addr);
+    sin->sin_family      = AF_INET;
+    sin->sin_addr.s_addr = htonl(0x0A000000 | (uint32_t)(index & 0xffffff));
+  } else {
+    struct sockaddr_in6 *sin6 = reinterpret_cast<struct sockaddr_in6 *>(addr);
+    sin6->sin6_family = AF_INET6;
+    unsigned char *bytes = sin6->sin6_addr.s6_addr;
+    bytes[0]  = 0xfd;
+    bytes[12] = (unsigned char)(index >> 24);
+    bytes[13] = (unsigned char)(index >> 16);
+    bytes[14] = (unsigned char)(index >> 8);
+    bytes[15] = (unsigned char)index;
+  }
+}
+
+void LoadGenerator::TimedFDs::ProcessFD(ares_socket_t fd) {
+  unsigned long long begin = BenchNowNs();
+  extra_->ProcessFD(fd);
+  ns_ += BenchNowNs() - begin;
+}
+
+void LoadGenerator::Issue(ares_channel_t *channel, Slot *slot) {
+  size_t index = NextName();
+  if (recording_)
+    result_.issued_++;
+  issuing_ = true;
+  if (!addrs_.empty()) {
+    const struct sockaddr *sa = reinterpret_cast<const struct sockaddr *>(&addrs_[index]);
+    if (opts_.api == "getnameinfo") {
+      ares_getnameinfo(channel, sa,
+                       sa->sa_family == AF_INET ? sizeof(struct sockaddr_in)
+                                                : sizeof(struct sockaddr_in6),
+                       ARES_NI_LOOKUPHOST | ARES_NI_NAMEREQD,
+                       NameInfoCallback, slot);
+    } else if (sa->sa_family == AF_INET) {
+      ares_gethostbyaddr(channel, &reinterpret_cast<const struct sockaddr_in *>(sa)->sin_addr,
+                         sizeof(struct in_addr), AF_INET, HostCallback, slot);
+    } else {
+      ares_gethostbyaddr(channel, &reinterpret_cast<const struct sockaddr_in6 *>(sa)->sin6_addr,
+                         sizeof(struct in6_addr), AF_INET6, HostCallback, slot);
+    }
+    issuing_ = false;
+    return;
+  }
+  const char *name = names_[index].c_str();
+  if (opts_.api == "getaddrinfo") {
+    struct ares_addrinfo_hints hints = {};
+    hints.ai_family = opts_.family;
+    hints.ai_flags  = ARES_AI_NOSORT;
+    ares_getaddrinfo(channel, name, NULL, &hints, AddrInfoCallback, slot);
+  } else if (opts_.api == "gethostbyname") {
+    ares_gethostbyname(channel, name, opts_.family, HostCallback, slot);
+  } else {
+    ares_search(channel, name, C_IN, opts_.family == AF_INET6 ? T_AAAA : T_A,
+                SearchCallback, slot);
+  }
+  issuing_ = false;
+}
+
+void LoadGenerator::Complete(Slot *slot, int status) {
+  if (recording_) {
+    result_.completed_++;
+    if (status != ARES_SUCCESS)
+      result_.failed_++;
+    unsigned long long latency = BenchNowNs() - slot->issued_ns_;
+    result_.latency_.Add(latency);
+    if (issuing_) {
+      result_.hits_++;
+      result_.hit_latency_.Add(latency);
+    } else {
+      result_.miss_latency_.Add(latency);
+    }
+  }
+  ready_.push_back(slot);
+}
+
+void LoadGenerator::AddrInfoCallback(void *data, int status, int timeouts,
+                                     struct ares_addrinfo *ai) {
+  (void)timeouts;
+  if (ai)
+    ares_freeaddrinfo(ai);
+  Slot *slot = reinterpret_cast<Slot *>(data);
+  slot->gen_->Complete(slot, status);
+}
+
+void LoadGenerator::HostCallback(void *data, int status, int timeouts,
+                                 struct hostent *hostent) {
+  (void)timeouts;
+  (void)hostent;
+  Slot *slot = reinterpret_cast<Slot *>(data);
+  slot->gen_->Complete(slot, status);
+}
+
+void LoadGenerator::SearchCallback(void *data, int status, int timeouts,
+                                   unsigned char *abuf, int alen) {
+  (void)timeouts;
+  (void)abuf;
+  (void)alen;
+  Slot *slot = reinterpret_cast<Slot *>(data);
+  slot->gen_->Complete(slot, status);
+}
+
+void LoadGenerator::NameInfoCallback(void *data, int status, int timeouts,
+                                     char *node, char *service) {
+  (void)timeouts;
+  (void)node;
+  (void)service;
+  Slot *slot = reinterpret_cast<Slot *>(data);
+  slot->gen_->Complete(slot, status);
+}
+
+LoadResult LoadGenerator::Run(ares_channel_t *channel, ExtraFDs *extra) {
+  TimedFDs timed(extra);
+  result_ = LoadResult();
+  slots_.assign(opts_.outstanding, Slot());
+  ready_.clear();
+  ready_.reserve(opts_.outstanding);
+  for (Slot &slot : slots_) {
+    slot.gen_ = this;
+    ready_.push_back(&slot);
+  }
+
+  recording_ = true;
+  unsigned long long start    = BenchNowNs();
+  unsigned long long cpu      = BenchCpuNs();
+  unsigned long long deadline = start + (unsigned long long)opts_.duration_ms * 1000000ULL;
+  unsigned long long now      = start;
+  unsigned long long sent     = 0;
+  size_t             burst    = 0;
+  while ((now = BenchNowNs()) < deadline) {
+    unsigned long long wait_until = deadline;
+    if (burst >= kMaxBurst) {
+      // Behind schedule: poll for replies between sends, as an event loop
+      // would, rather than starving them until the backlog is cleared.
+      wait_until = now;
+      burst      = 0;
+    } else if (!ready_.empty()) {
+      unsigned long long due = now;
+      if (opts_.rate > 0)
+        due = start + (unsigned long long)((double)sent * 1e9 / opts_.rate);
+      if (due <= now) {
+        Slot *slot = ready_.back();
+        ready_.pop_back();
+        slot->issued_ns_ = due;
+        if (opts_.rate > 0)
+          result_.send_lag_.Add(now - due);
+        sent++;
+        burst++;
+        Issue(channel, slot);
+        result_.issue_ns_ += BenchNowNs() - now;
+        continue;
+      }
+      if (due < wait_until)
+        wait_until = due;
+    }
+    burst = 0;
+
+    // Wait for replies, but not past the next send or the deadline.
+    unsigned long long remaining = wait_until - now;
+    struct timeval     maxtv;
+    maxtv.tv_sec  = (time_t)(remaining / 1000000000ULL);
+    maxtv.tv_usec = (suseconds_t)((remaining % 1000000000ULL) / 1000ULL);
+    if (!ProcessStep(channel, &timed, &maxtv)) {
+      // Nothing in flight, so just sleep until the next query is due.
+      struct timespec ts;
+      ts.tv_sec  = (time_t)(remaining / 1000000000ULL);
+      ts.tv_nsec = (long)(remaining % 1000000000ULL);
+      nanosleep(&ts, NULL);
+    }
+  }
+  result_.elapsed_ns_ = now - start;
+  result_.cpu_ns_     = BenchCpuNs() - cpu;
+  result_.server_ns_  = timed.ns_;
+  recording_          = false;
+
+  // Let whatever is still in flight finish so the channel is left idle.
+  ProcessWork(channel, extra);
+  return result_;
+}
@@ -0,0 +1,168 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "ares-bench.h"
+
+// Zone that answers A and AAAA queries for every name under a suffix with a
+// single synthesized address, so that load runs can use any number of names
+// without building them up front.  PTR queries for any reverse lookup name
+// are answered with a name under the suffix.  Each name gets a TTL picked
+// from [ttl_min, ttl_max] by a hash of the name, so a given name always has
+// the same TTL.  Other names get NXDOMAIN.
+class LoadZone : public MockZone {
+public:
+  LoadZone(const std::string &suffix, unsigned int ttl_min,
+           unsigned int ttl_max);
+
+  static unsigned int Hash(const std::string &name);
+
+protected:
+  int Records(const std::string &name, int rrtype,
+              std::vector<byte> *reply) const override;
+
+private:
+  std::string  suffix_;
+  unsigned int ttl_min_;
+  unsigned int ttl_max_;
+};
+
+// Parameters for a load run.
+struct LoadOptions {
+  LoadOptions()
+    : api("getaddrinfo"), family(AF_INET), outstanding(100),
+      duration_ms(1000), names(1000), zipf(0), ttl_min(0), ttl_max(0), rate(0)
+  {
+  }
+
+  // One of "getaddrinfo", "gethostbyname" or "search" for forward lookups
+  // of names, or "gethostbyaddr" or "getnameinfo" for reverse lookups of
+  // addresses.  AF_UNSPEC reverse lookups alternate IPv4 and IPv6.
+  std::string  api;
+  int          family;
+  // Closed loop: queries kept in flight on the channel at all times.
+  // Open loop: the most that may be in flight before the schedule slips.
+  size_t       outstanding;
+  unsigned int duration_ms;
+  // Number of distinct names queried.
+  size_t       names;
+  // Zipf exponent for how popular each name is, or 0 to cycle through the
+  // names in order.
+  double       zipf;
+  unsigned int ttl_min;
+  unsigned int ttl_max;
+  // Queries per second to issue on a fixed schedule (open loop), or 0 to
+  // reissue each query as it completes (closed loop).
+  double       rate;
+};
+
+// Results of a load run.  Only queries that complete before the deadline
+// are counted; the ones still in flight then are drained and discarded.
+struct LoadResult {
+  LoadResult()
+    : issued_(0), completed_(0), failed_(0), hits_(0), elapsed_ns_(0),
+      cpu_ns_(0), server_ns_(0), issue_ns_(0)
+  {
+  }
+
+  // Add qps, CPU per query and latency percentiles to a benchmark record.
+  BenchRecord &Report(BenchRecord &record) const;
+
+  unsigned long long issued_;
+  unsigned long long completed_;
+  unsigned long long failed_;
+  // Queries answered from inside the issuing call, which for a well formed
+  // name means the answer came from the query cache.
+  unsigned long long hits_;
+  unsigned long long elapsed_ns_;
+  // Process CPU time over the run, and the part of it that was spent
+  // inside the mock servers rather than the library.
+  unsigned long long cpu_ns_;
+  unsigned long long server_ns_;
+  // Time spent inside the library calls that start each query.
+  unsigned long long issue_ns_;
+  // Latency is measured from the time a query was due to be sent, so in
+  // open loop mode it includes any time spent waiting for a free slot.
+  LatencyHistogram   latency_;
+  // Open loop only: how far behind schedule each query was actually sent.
+  LatencyHistogram   send_lag_;
+  // latency_ split by whether the query was a cache hit.
+  LatencyHistogram   hit_latency_;
+  LatencyHistogram   miss_latency_;
+};
+
+// Load generator for one channel.  In closed loop mode it keeps a fixed
+// number of queries outstanding and reissues each one as soon as it
+// completes.  In open loop mode it issues queries at a fixed rate whether or
+// not earlier ones have completed, which exposes queueing that closed loop
+// numbers hide.
+class LoadGenerator {
+public:
+  LoadGenerator(const LoadOptions &opts, const std::string &domain);
+  virtual ~LoadGenerator()
+  {
+  }
+
+  // Run against channel until opts.duration_ms has passed, driving the
+  // mock servers through extra.
+  LoadResult Run(ares_channel_t *channel, ExtraFDs *extra);
+
+  // The index'th address used for reverse lookups.
+  static void Address(size_t index, int family, struct sockaddr_storage *addr);
+
+protected:
+  // Index of the next name to query.
+  virtual size_t NextName();
+
+private:
+  struct Slot {
+    LoadGenerator     *gen_;
+    unsigned long long issued_ns_;
+  };
+
+  // Times the mock servers' share of each ProcessStep().
+  class TimedFDs : public ExtraFDs {
+  public:
+    TimedFDs(ExtraFDs *extra) : extra_(extra), ns_(0)
+    {
+    }
+
+    const std::vector<ares_socket_t> &CachedFDs() override
+    {
+      return extra_->CachedFDs();
+    }
+
+    void ProcessFD(ares_socket_t fd) override;
+
+    ExtraFDs          *extra_;
+    unsigned long long ns_;
+  };
+
+  void        Issue(ares_channel_t *channel, Slot *slot);
+  void        Complete(Slot *slot, int status);
+
+  static void AddrInfoCallback(void *data, int status, int timeouts,
+                               struct ares_addrinfo *ai);
+  static void HostCallback(void *data, int status, int timeouts,
+                           struct hostent *hostent);
+  static void SearchCallback(void *data, int status, int timeouts,
+                             unsigned char *abuf, int alen);
+  static void NameInfoCallback(void *data, int status, int timeouts,
+                               char *node, char *service);
+
+  LoadOptions              opts_;
+  std::vector<std::string> names_;
+  std::vector<struct sockaddr_storage> addrs_;
+  size_t                   next_;
+  // Cumulative Zipf distribution over names_, if opts_.zipf is set.
+  std::vector<double>      zipf_cdf_;
+  unsigned long long       rng_;
+  std::vector<Slot>        slots_;
+  // Slots whose query has completed and that are waiting to be reissued.
+  // Callbacks only push here, so a query answered synchronously (say from
+  // the cache) never recurses back into the library.
+  std::vector<Slot *>      ready_;
+  bool                     recording_;
+  bool                     issuing_;
+  LoadResult               result_;
+};
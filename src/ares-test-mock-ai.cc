@@ -277,6 +277,50 @@ TEST_P(MockTCPChannelTestAI, YXDomainResponse) {
   EXPECT_EQ(ARES_ENODATA, result.status_);
 }
 
+TEST_P(MockTCPChannelTestAI, ConnectionReuse) {
+  SyscallCounter syscalls;
+  syscalls.Install(channel_);
+
+  // TTL of zero keeps the answer out of the query cache, so that every
+  // lookup goes over a connection.
+  DNSPacket rsp;
+  rsp.set_response().set_aa()
+    .add_question(new DNSQuestion("www.google.com", T_A))
+    .add_answer(new DNSARR("www.google.com", 0, {0x01, 0x02, 0x03, 0x04}));
+  ON_CALL(server_, OnRequest("www.google.com", T_A))
+    .WillByDefault(SetReply(&server_, &rsp));
+
+  struct ares_addrinfo_hints hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_flags = ARES_AI_NOSORT;
+  AddrInfoResult results[5];
+  for (AddrInfoResult &result : results) {
+    ares_getaddrinfo(channel_, "www.google.com.", NULL, &hints, AddrInfoCallback, &result);
+  }
+  Process();
+  for (const AddrInfoResult &result : results) {
+    EXPECT_TRUE(result.done_);
+    EXPECT_EQ(ARES_SUCCESS, result.status_);
+  }
+
+  // One connection carries all the concurrent queries, and is closed once
+  // it is idle as ARES_FLAG_STAYOPEN is not set.
+  EXPECT_EQ(1ULL, syscalls.sockets_);
+  EXPECT_EQ(1ULL, syscalls.connects_);
+  EXPECT_EQ(1ULL, syscalls.closes_);
+  EXPECT_LE(1ULL, syscalls.sends_);
+  EXPECT_LE(1ULL, syscalls.recvs_);
+
+  // So the next query needs a new one.
+  AddrInfoResult result;
+  ares_getaddrinfo(channel_, "www.google.com.", NULL, &hints, AddrInfoCallback, &result);
+  Process();
+  EXPECT_TRUE(result.done_);
+  EXPECT_EQ(ARES_SUCCESS, result.status_);
+  EXPECT_EQ(2ULL, syscalls.sockets_);
+  EXPECT_EQ(2ULL, syscalls.connects_);
+}
+
 class MockExtraOptsTestAI
     : public MockChannelOptsTest,
       public ::testing::WithParamInterface< std::pair<int, bool> > {
@@ -526,6 +570,124 @@ TEST_P(MockChannelTestAI, FamilyV6) {
   EXPECT_THAT(result.ai_, IncludesV6Address("2121:0000:0000:0000:0000:0000:0000:0303"));
 }
 
+TEST_P(MockChannelTestAI, InMemoryTransport) {
+  InMemoryTransport transport;
+  transport.AddServer(&server_);
+  transport.Install(channel_);
+
+  DNSPacket rsp4;
+  rsp4.set_response().set_aa()
+    .add_question(new DNSQuestion("example.com", T_A))
+    .add_answer(new DNSARR("example.com", 0, {2, 3, 4, 5}));
+  ON_CALL(server_, OnRequest("example.com", T_A))
+    .WillByDefault(SetReply(&server_, &rsp4));
+  DNSPacket rsp6;
+  rsp6.set_response().set_aa()
+    .add_question(new DNSQuestion("example.com", T_AAAA))
+    .add_answer(new DNSAaaaRR("example.com", 0,
+                              {0x21, 0x21, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                               0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03, 0x03}));
+  ON_CALL(server_, OnRequest("example.com", T_AAAA))
+    .WillByDefault(SetReply(&server_, &rsp6));
+
+  // Sorting the answers makes the library probe each address with a
+  // socket of its own, which the transport has to handle too.
+  for (int i = 0; i < 2; i++) {
+    AddrInfoResult result;
+    struct ares_addrinfo_hints hints = {};
+    hints.ai_family = AF_UNSPEC;
+    ares_getaddrinfo(channel_, "example.com.", NULL, &hints,
+                     AddrInfoCallback, &result);
+    Process();
+    EXPECT_TRUE(result.done_);
+    EXPECT_EQ(ARES_SUCCESS, result.status_);
+    EXPECT_THAT(result.ai_, IncludesNumAddresses(2));
+    EXPECT_THAT(result.ai_, IncludesV4Address("2.3.4.5"));
+    EXPECT_THAT(result.ai_, IncludesV6Address("2121:0000:0000:0000:0000:0000:0000:0303"));
+    // A dropped connection is seen as one, and the next lookup reconnects.
+    server_.Disconnect();
+  }
+  EXPECT_EQ(4ULL, transport.requests());
+  EXPECT_EQ(4ULL, transport.replies());
+}
+
+TEST_P(MockChannelTestAI, TimeoutVirtualClock) {
+  // No reply is ever sent, so the lookup runs through every try.
+  EXPECT_CALL(server_, OnRequest("www.google.com", T_A))
+    .Times(3);
+
+  VirtualClock clock;
+  unsigned long long skipped = VirtualClock::skipped_ns();
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
+  AddrInfoResult result;
+  struct ares_addrinfo_hints hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_flags = ARES_AI_NOSORT;
+  ares_getaddrinfo(channel_, "www.google.com.", NULL, &hints, AddrInfoCallback, &result);
+  Process();
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+  EXPECT_TRUE(result.done_);
+  EXPECT_EQ(ARES_ETIMEOUT, result.status_);
+  EXPECT_EQ(3, result.timeouts_);
+
+  // At least the 1500ms timeout for each try was skipped rather than
+  // waited for.
+  long long real_ms = (long long)(end.tv_sec - begin.tv_sec) * 1000 +
+                      (end.tv_nsec - begin.tv_nsec) / 1000000;
+  EXPECT_LE(3 * 1500000000ULL, VirtualClock::skipped_ns() - skipped);
+  EXPECT_GT(1000, real_ms);
+}
+
+// Blocks held by a getaddrinfo result: the result and its name, each node
+// and its address, and each CNAME with its alias and name.
+static long long AddrInfoBlocks(const struct ares_addrinfo *ai) {
+  long long blocks = 1 + (ai->name ? 1 : 0);
+  for (const ares_addrinfo_node *node = ai->nodes; node; node = node->ai_next)
+    blocks += 1 + (node->ai_addr ? 1 : 0);
+  for (const ares_addrinfo_cname *cname = ai->cnames; cname; cname = cname->next)
+    blocks += 1 + (cname->alias ? 1 : 0) + (cname->name ? 1 : 0);
+  return blocks;
+}
+
+TEST_P(MockChannelTestAI, HeapCheckReportsLeak) {
+  DNSPacket reply;
+  reply.set_response().set_aa()
+    .add_question(new DNSQuestion("www.google.com", T_A))
+    .add_answer(new DNSARR("www.google.com", 0x0100, {0x01, 0x02, 0x03, 0x04}));
+  ON_CALL(server_, OnRequest("www.google.com", T_A))
+    .WillByDefault(SetReply(&server_, &reply));
+
+  // A result still held when the test ends is all that leaks, once the
+  // channel that made it is gone.  (The nested listener resets the peak,
+  // so this test's own HEAP line under-reports it.)
+  const ::testing::TestInfo *info =
+    ::testing::UnitTest::GetInstance()->current_test_info();
+  HeapCheckListener heap(true);
+  AddrInfoResult result;
+  heap.OnTestStart(*info);
+  ares_channel_t *channel = NewChannel();
+  ASSERT_NE(nullptr, channel);
+  struct ares_addrinfo_hints hints = {};
+  hints.ai_family = AF_INET;
+  hints.ai_flags = ARES_AI_NOSORT;
+  ares_getaddrinfo(channel, "www.google.com.", NULL, &hints, AddrInfoCallback, &result);
+  ProcessWork(channel, this);
+  ares_destroy(channel);
+  heap.OnTestEnd(*info);
+  EXPECT_TRUE(result.done_);
+  EXPECT_EQ(ARES_SUCCESS, result.status_);
+  ASSERT_NE(nullptr, result.ai_.get());
+  ASSERT_EQ(1U, heap.leaked().size());
+  EXPECT_EQ(AddrInfoBlocks(result.ai_.get()), heap.leaked()[0].blocks_);
+
+  // Freeing it in a later test is not a leak.
+  heap.OnTestStart(*info);
+  result.ai_.reset();
+  heap.OnTestEnd(*info);
+  EXPECT_EQ(1U, heap.leaked().size());
+}
+
 #ifndef CARES_SYMBOL_HIDING
 // Test case for Issue #662
 TEST_P(MockChannelTestAI, PartialQueryCancel) {
@@ -700,6 +862,43 @@ TEST_P(NoRotateMultiMockTestAI, ThirdServer) {
   CheckExample();
 }
 
+class RotateMultiMockTestAI : public MockMultiServerChannelTestAI {
+ public:
+  RotateMultiMockTestAI() : MockMultiServerChannelTestAI(true) {}
+};
+
+TEST_P(RotateMultiMockTestAI, SpreadsLoad) {
+  struct ares_options opts;
+  int optmask = 0;
+  memset(&opts, 0, sizeof(opts));
+  EXPECT_EQ(ARES_SUCCESS, ares_save_options(channel_, &opts, &optmask));
+  EXPECT_EQ(ARES_OPT_ROTATE, (optmask & ARES_OPT_ROTATE));
+  ares_destroy_options(&opts);
+
+  // TTL of zero keeps the answer out of the query cache, so that every
+  // lookup picks a server.
+  DNSPacket okrsp;
+  okrsp.set_response().set_aa()
+    .add_question(new DNSQuestion("www.example.com", T_A))
+    .add_answer(new DNSARR("www.example.com", 0, {2,3,4,5}));
+  for (const auto &server : servers_) {
+    ON_CALL(*server, OnRequest("www.example.com", T_A))
+      .WillByDefault(SetReply(server.get(), &okrsp));
+  }
+
+  // Servers are picked at random, so with no failures the odds of 30
+  // lookups all going to one server are negligible.
+  for (int i = 0; i < 30; i++) {
+    CheckExample();
+  }
+  unsigned long total = 0;
+  for (const auto &server : servers_) {
+    EXPECT_GT(30UL, server->requests());
+    total += server->requests();
+  }
+  EXPECT_EQ(30UL, total);
+}
+
 const char *af_tostr(int af)
 {
   switch (af) {
@@ -757,3 +956,6 @@ INSTANTIATE_TEST_SUITE_P(AddressFamiliesAI, MockEDNSChannelTestAI,
 
 INSTANTIATE_TEST_SUITE_P(TransportModesAI, NoRotateMultiMockTestAI,
 			::testing::ValuesIn(families_modes), PrintFamilyMode);
+
+INSTANTIATE_TEST_SUITE_P(TransportModesAI, RotateMultiMockTestAI,
+			::testing::ValuesIn(families_modes), PrintFamilyMode);
@@ -0,0 +1,120 @@
+// Mock-backed counterparts of the LiveGetHostByAddr and LiveGetNameInfo
+// tests, answering from an in-memory in-addr.arpa / ip6.arpa zone.
+
+#include "ares-test.h"
+#include "dns-proto.h"
+
+static const unsigned char ptr_addr4[4]  = {0x01, 0x01, 0x01, 0x01};
+static const unsigned char ptr_addr6[16] = {
+  0x26, 0x06, 0x47, 0x00, 0x47, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x11, 0x11
+};
+// Has no PTR record.
+static const unsigned char ptr_missing4[4] = {0x0a, 0x0b, 0x0c, 0x0d};
+
+class MockPTRTest
+  : public MockChannelOptsTest,
+    public ::testing::WithParamInterface<std::pair<int, bool>> {
+public:
+  MockPTRTest()
+    : MockChannelOptsTest(1, GetParam().first, GetParam().second, nullptr, 0)
+  {
+    zone_.Add(new DNSPtrRR(ReverseLookupName(ptr_addr4, 4), 300, "one.one.one.one"))
+      .Add(new DNSPtrRR(ReverseLookupName(ptr_addr6, 16), 300, "one.one.one.one"))
+      .AddSOA(new DNSSoaRR("in-addr.arpa", 300, "ns1.example.com", "hostmaster.example.com",
+                           1, 3600, 600, 86400, 60));
+    server_.SetZone(&zone_);
+  }
+
+protected:
+  MockZone zone_;
+};
+
+TEST(ReverseLookupName, Format) {
+  EXPECT_EQ("1.1.1.1.in-addr.arpa", ReverseLookupName(ptr_addr4, 4));
+  EXPECT_EQ("13.12.11.10.in-addr.arpa", ReverseLookupName(ptr_missing4, 4));
+  EXPECT_EQ("1.1.1.1.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.0.7.4.0.0.7.4.6.0.6.2.ip6.arpa",
+            ReverseLookupName(ptr_addr6, 16));
+}
+
+TEST_P(MockPTRTest, GetHostByAddrV4) {
+  HostResult result;
+  ares_gethostbyaddr(channel_, ptr_addr4, sizeof(ptr_addr4), AF_INET, HostCallback, &result);
+  Process();
+  EXPECT_TRUE(result.done_);
+  EXPECT_EQ(ARES_SUCCESS, result.status_);
+  EXPECT_EQ("one.one.one.one", result.host_.name_);
+  EXPECT_EQ(AF_INET, result.host_.addrtype_);
+  ASSERT_EQ(1, (int)result.host_.addrs_.size());
+  EXPECT_EQ("1.1.1.1", result.host_.addrs_[0]);
+}
+
+TEST_P(MockPTRTest, GetHostByAddrV6) {
+  HostResult result;
+  ares_gethostbyaddr(channel_, ptr_addr6, sizeof(ptr_addr6), AF_INET6, HostCallback, &result);
+  Process();
+  EXPECT_TRUE(result.done_);
+  EXPECT_EQ(ARES_SUCCESS, result.status_);
+  EXPECT_EQ("one.one.one.one", result.host_.name_);
+  EXPECT_EQ(AF_INET6, result.host_.addrtype_);
+  EXPECT_EQ(1, (int)result.host_.addrs_.size());
+}
+
+TEST_P(MockPTRTest, GetHostByAddrNotFound) {
+  HostResult result;
+  ares_gethostbyaddr(channel_, ptr_missing4, sizeof(ptr_missing4), AF_INET, HostCallback, &result);
+  Process();
+  EXPECT_TRUE(result.done_);
+  EXPECT_EQ(ARES_ENOTFOUND, result.status_);
+}
+
+TEST_P(MockPTRTest, GetNameInfoV4) {
+  NameInfoResult result;
+  struct sockaddr_in sockaddr;
+  memset(&sockaddr, 0, sizeof(sockaddr));
+  sockaddr.sin_family = AF_INET;
+  sockaddr.sin_port = htons(53);
+  memcpy(&sockaddr.sin_addr, ptr_addr4, sizeof(ptr_addr4));
+  ares_getnameinfo(channel_, (const struct sockaddr*)&sockaddr, sizeof(sockaddr),
+                   ARES_NI_LOOKUPHOST|ARES_NI_LOOKUPSERVICE|ARES_NI_UDP,
+                   NameInfoCallback, &result);
+  Process();
+  EXPECT_TRUE(result.done_);
+  EXPECT_EQ(ARES_SUCCESS, result.status_);
+  EXPECT_EQ("one.one.one.one", result.node_);
+  EXPECT_EQ("domain", result.service_);
+}
+
+TEST_P(MockPTRTest, GetNameInfoV6) {
+  NameInfoResult result;
+  struct sockaddr_in6 sockaddr;
+  memset(&sockaddr, 0, sizeof(sockaddr));
+  sockaddr.sin6_family = AF_INET6;
+  sockaddr.sin6_port = htons(53);
+  memcpy(sockaddr.sin6_addr.s6_addr, ptr_addr6, sizeof(ptr_addr6));
+  ares_getnameinfo(channel_, (const struct sockaddr*)&sockaddr, sizeof(sockaddr),
+                   ARES_NI_TCP|ARES_NI_LOOKUPHOST|ARES_NI_LOOKUPSERVICE,
+                   NameInfoCallback, &result);
+  Process();
+  EXPECT_TRUE(result.done_);
+  EXPECT_EQ(ARES_SUCCESS, result.status_);
+  EXPECT_EQ("one.one.one.one", result.node_);
+  EXPECT_EQ("domain", result.service_);
+}
+
+TEST_P(MockPTRTest, GetNameInfoV4NotFoundFail) {
+  NameInfoResult result;
+  struct sockaddr_in sockaddr;
+  memset(&sockaddr, 0, sizeof(sockaddr));
+  sockaddr.sin_family = AF_INET;
+  memcpy(&sockaddr.sin_addr, ptr_missing4, sizeof(ptr_missing4));
+  ares_getnameinfo(channel_, (const struct sockaddr*)&sockaddr, sizeof(sockaddr),
+                   ARES_NI_LOOKUPHOST|ARES_NI_NAMEREQD,
+                   NameInfoCallback, &result);
+  Process();
+  EXPECT_TRUE(result.done_);
+  EXPECT_EQ(ARES_ENOTFOUND, result.status_);
+}
+
+INSTANTIATE_TEST_SUITE_P(AddressFamilies, MockPTRTest,
+                         ::testing::ValuesIn(families_modes));
@@ -1,8 +1,18 @@
 #include "ares-test.h"
 #include "dns-proto.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <assert.h>
 #include <fcntl.h>
+#include <malloc.h>
+#include <poll.h>
 #include <unistd.h>
+#include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
 
 bool verbose = false;
 const std::vector<int> both_families = {AF_INET, AF_INET6};
@@ -101,13 +111,171 @@ void ares__timeval_remaining(struct timeval       *remaining,
   }
 }
 
-void ProcessWork(ares_channel_t *channel,
-                 std::function<std::set<ares_socket_t>()> get_extrafds,
-                 std::function<void(ares_socket_t)> process_extra,
-                 unsigned int cancel_ms) {
+static std::atomic<unsigned long long> virtual_skipped_ns(0);
+static std::atomic<int>                virtual_clocks(0);
+
+typedef int (*clock_gettime_fn)(clockid_t, struct timespec *);
+
+// Every clock_gettime() call in the process, the library's included, comes
+// here; while a VirtualClock is alive, skipped time is added to the clocks
+// that timeouts are measured on.
+extern "C" int clock_gettime(clockid_t clk, struct timespec *ts) {
+  static clock_gettime_fn real =
+    reinterpret_cast<clock_gettime_fn>(dlsym(RTLD_NEXT, "clock_gettime"));
+  int rc = real(clk, ts);
+  if (rc != 0 || virtual_clocks.load(std::memory_order_relaxed) == 0) {
+    return rc;
+  }
+  unsigned long long skipped = virtual_skipped_ns.load(std::memory_order_relaxed);
+  if (skipped == 0) {
+    return rc;
+  }
+  switch (clk) {
+    case CLOCK_MONOTONIC:
+    case CLOCK_MONOTONIC_COARSE:
+    case CLOCK_BOOTTIME:
+      break;
+    default:
+      return rc;
+  }
+  unsigned long long nsec = (unsigned long long)ts->tv_nsec + skipped % 1000000000ULL;
+  ts->tv_sec  += (time_t)(skipped / 1000000000ULL + nsec / 1000000000ULL);
+  ts->tv_nsec  = (long)(nsec % 1000000000ULL);
+  return rc;
+}
+
+VirtualClock::VirtualClock() {
+  virtual_clocks++;
+}
+
+VirtualClock::~VirtualClock() {
+  if (--virtual_clocks == 0) {
+    virtual_skipped_ns = 0;
+  }
+}
+
+bool VirtualClock::enabled() {
+  return virtual_clocks.load(std::memory_order_relaxed) > 0;
+}
+
+void VirtualClock::Advance(unsigned long long ns) {
+  virtual_skipped_ns += ns;
+}
+
+unsigned long long VirtualClock::skipped_ns() {
+  return virtual_skipped_ns.load();
+}
+
+static unsigned long long ProcessNowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+// Cost of one ProcessNowNs() call, so that the clock reads made for the
+// accounting are not themselves billed to the harness.
+static unsigned long long ProcessClockCost() {
+  static unsigned long long cost = 0;
+  static bool calibrated = false;
+  if (!calibrated) {
+    const int reads = 10000;
+    unsigned long long begin = ProcessNowNs();
+    for (int i = 0; i < reads; i++) {
+      ProcessNowNs();
+    }
+    cost = (ProcessNowNs() - begin) / reads;
+    calibrated = true;
+  }
+  return cost;
+}
+
+bool ProcessStep(ares_channel_t *channel, ExtraFDs *extra,
+                 struct timeval *maxtv, ProcessStats *stats) {
   int nfds, count;
   fd_set readers, writers;
+  struct timeval  tv;
+  struct timeval *tv_select;
+  unsigned long long t_begin = 0, t_mark = 0, t_external = 0;
+  unsigned long long brackets = 1;
+  bool more = true;
+
+  // Time spent outside of the harness (library, select(), extra FD
+  // handlers) is bracketed so that it can be subtracted from the total.
+#define PROCESS_EXTERNAL_BEGIN() do { if (stats) t_mark = ProcessNowNs(); } while (0)
+#define PROCESS_EXTERNAL_END()   do { if (stats) { t_external += ProcessNowNs() - t_mark; brackets++; } } while (0)
+
+  if (stats) {
+    t_begin = ProcessNowNs();
+    stats->iterations_++;
+  }
+
+  // Retrieve the set of file descriptors that the library wants us to
+  // monitor, and how long we may wait for them.  If ares_timeout returns
+  // NULL, it means there are no requests in queue, so we can break out.
+  FD_ZERO(&readers);
+  FD_ZERO(&writers);
+  PROCESS_EXTERNAL_BEGIN();
+  nfds      = ares_fds(channel, &readers, &writers);
+  tv_select = ares_timeout(channel, maxtv, &tv);
+  PROCESS_EXTERNAL_END();
+  if (nfds == 0 || tv_select == NULL) {  // no work left to do in the library
+    more = false;
+  } else {
+    // Add in the extra FDs if present.
+    const std::vector<ares_socket_t> &extrafds = extra->CachedFDs();
+    for (ares_socket_t extrafd : extrafds) {
+      FD_SET(extrafd, &readers);
+      if (extrafd >= (ares_socket_t)nfds) {
+        nfds = (int)extrafd + 1;
+      }
+    }
+
+    // Wait, then let the library process any activity.  With a virtual
+    // clock, only poll, and if nothing is ready skip ahead to the timeout.
+    struct timeval zero = {0, 0};
+    bool virtual_clock = VirtualClock::enabled();
+    PROCESS_EXTERNAL_BEGIN();
+    count = select(nfds, &readers, &writers, nullptr,
+                   virtual_clock ? &zero : tv_select);
+    if (count == 0 && virtual_clock) {
+      VirtualClock::Advance((unsigned long long)tv_select->tv_sec * 1000000000ULL +
+                            (unsigned long long)tv_select->tv_usec * 1000ULL);
+    }
+    if (count >= 0)
+      ares_process(channel, &readers, &writers);
+    PROCESS_EXTERNAL_END();
+    if (count < 0) {
+      fprintf(stderr, "select() failed, errno %d\n", errno);
+      more = false;
+    } else {
+      // Let the provided handler process any activity on the extra FDs.
+      // The cached list is only rebuilt on the next CachedFDs() call, so it
+      // stays valid even if a handler opens or closes descriptors.
+      for (size_t i = 0; i < extrafds.size(); i++) {
+        if (FD_ISSET(extrafds[i], &readers)) {
+          PROCESS_EXTERNAL_BEGIN();
+          extra->ProcessFD(extrafds[i]);
+          PROCESS_EXTERNAL_END();
+        }
+      }
+    }
+  }
+
+#undef PROCESS_EXTERNAL_BEGIN
+#undef PROCESS_EXTERNAL_END
+
+  if (stats) {
+    unsigned long long total   = ProcessNowNs() - t_begin;
+    unsigned long long harness = total - t_external;
+    unsigned long long clocks  = brackets * ProcessClockCost();
+    stats->total_ns_   += total;
+    stats->harness_ns_ += harness > clocks ? harness - clocks : 0;
+  }
+  return more;
+}
 
+void ProcessWork(ares_channel_t *channel, ExtraFDs *extra,
+                 unsigned int cancel_ms, ProcessStats *stats) {
 #ifndef CARES_SYMBOL_HIDING
   struct timeval tv_begin  = ares__tvnow();
   struct timeval tv_cancel = tv_begin;
@@ -124,37 +292,11 @@ void ProcessWork(ares_channel_t *channel,
 #endif
 
   while (true) {
+    struct timeval *maxtv = NULL;
 #ifndef CARES_SYMBOL_HIDING
-    struct timeval  tv_now = ares__tvnow();
     struct timeval  tv_remaining;
-#endif
-    struct timeval  tv;
-    struct timeval *tv_select;
-
-    // Retrieve the set of file descriptors that the library wants us to monitor.
-    FD_ZERO(&readers);
-    FD_ZERO(&writers);
-    nfds = ares_fds(channel, &readers, &writers);
-    if (nfds == 0)  // no work left to do in the library
-      return;
-
-    // Add in the extra FDs if present.
-    std::set<ares_socket_t> extrafds = get_extrafds();
-    for (ares_socket_t extrafd : extrafds) {
-      FD_SET(extrafd, &readers);
-      if (extrafd >= (ares_socket_t)nfds) {
-        nfds = (int)extrafd + 1;
-      }
-    }
-
-    /* If ares_timeout returns NULL, it means there are no requests in queue,
-     * so we can break out */
-    tv_select = ares_timeout(channel, NULL, &tv);
-    if (tv_select == NULL)
-      return;
-
-#ifndef CARES_SYMBOL_HIDING
     if (cancel_ms) {
+      struct timeval tv_now = ares__tvnow();
       unsigned int remaining_ms;
       ares__timeval_remaining(&tv_remaining,
                               &tv_now,
@@ -164,25 +306,127 @@ void ProcessWork(ares_channel_t *channel,
         ares_cancel(channel);
         cancel_ms = 0; /* Disable issuing cancel again */
       } else {
-        /* Recalculate proper timeout since we also have a cancel to wait on */
-        tv_select = ares_timeout(channel, &tv_remaining, &tv);
+        /* Wait no longer than the pending cancel */
+        maxtv = &tv_remaining;
       }
     }
 #endif
+    if (!ProcessStep(channel, extra, maxtv, stats))
+      break;
+  }
+}
 
-    count = select(nfds, &readers, &writers, nullptr, tv_select);
-    if (count < 0) {
-      fprintf(stderr, "select() failed, errno %d\n", errno);
-      return;
+// Adapts the std::function based ProcessWork() interface; the extra FD set
+// is fetched afresh on every iteration, exactly as callers expect.
+class FunctionExtraFDs : public ExtraFDs {
+public:
+  FunctionExtraFDs(std::function<std::set<ares_socket_t>()> get_extrafds,
+                   std::function<void(ares_socket_t)> process_extra)
+    : get_extrafds_(get_extrafds), process_extra_(process_extra)
+  {
+  }
+
+  const std::vector<ares_socket_t> &CachedFDs()
+  {
+    std::set<ares_socket_t> extrafds = get_extrafds_();
+    fds_.assign(extrafds.begin(), extrafds.end());
+    return fds_;
+  }
+
+  void ProcessFD(ares_socket_t fd)
+  {
+    process_extra_(fd);
+  }
+
+private:
+  std::function<std::set<ares_socket_t>()> get_extrafds_;
+  std::function<void(ares_socket_t)>       process_extra_;
+  std::vector<ares_socket_t>               fds_;
+};
+
+void ProcessWork(ares_channel_t *channel,
+                 std::function<std::set<ares_socket_t>()> get_extrafds,
+                 std::function<void(ares_socket_t)> process_extra,
+                 unsigned int cancel_ms, ProcessStats *stats) {
+  FunctionExtraFDs extra(get_extrafds, process_extra);
+  ProcessWork(channel, &extra, cancel_ms, stats);
+}
+
+void ProcessChannels(const std::vector<ares_channel_t *> &channels,
+                     ExtraFDs *extra) {
+  std::vector<ares_channel_t *> active(channels);
+  std::vector<struct pollfd>    pfds;
+  // Channel owning each entry in pfds, or nullptr for the extra FDs.
+  std::vector<ares_channel_t *> owners;
+
+  while (true) {
+    pfds.clear();
+    owners.clear();
+    int    wait_ms = -1;
+    size_t keep    = 0;
+    for (ares_channel_t *channel : active) {
+      struct timeval tv;
+      if (ares_timeout(channel, nullptr, &tv) == nullptr) {
+        continue;  // no work left on this channel
+      }
+      active[keep++] = channel;
+      int ms = (int)(tv.tv_sec * 1000 + (tv.tv_usec + 999) / 1000);
+      if (wait_ms < 0 || ms < wait_ms) {
+        wait_ms = ms;
+      }
+
+      ares_socket_t socks[ARES_GETSOCK_MAXNUM];
+      int bitmask = ares_getsock(channel, socks, ARES_GETSOCK_MAXNUM);
+      for (int i = 0; i < ARES_GETSOCK_MAXNUM; i++) {
+        short events = 0;
+        if (ARES_GETSOCK_READABLE(bitmask, i)) {
+          events |= POLLIN;
+        }
+        if (ARES_GETSOCK_WRITABLE(bitmask, i)) {
+          events |= POLLOUT;
+        }
+        if (events == 0) {
+          continue;
+        }
+        struct pollfd pfd = {socks[i], events, 0};
+        pfds.push_back(pfd);
+        owners.push_back(channel);
+      }
+    }
+    active.resize(keep);
+    if (active.empty()) {
+      break;
     }
 
-    // Let the library process any activity.
-    ares_process(channel, &readers, &writers);
+    for (ares_socket_t extrafd : extra->CachedFDs()) {
+      struct pollfd pfd = {extrafd, POLLIN, 0};
+      pfds.push_back(pfd);
+      owners.push_back(nullptr);
+    }
 
-    // Let the provided callback process any activity on the extra FD.
-    for (ares_socket_t extrafd : extrafds) {
-      if (FD_ISSET(extrafd, &readers)) {
-        process_extra(extrafd);
+    bool virtual_clock = VirtualClock::enabled();
+    int count = poll(pfds.data(), (nfds_t)pfds.size(), virtual_clock ? 0 : wait_ms);
+    if (count == 0) {
+      if (virtual_clock) {
+        VirtualClock::Advance((unsigned long long)wait_ms * 1000000ULL);
+      }
+      // Timed out: let every channel handle its expired queries.
+      for (ares_channel_t *channel : active) {
+        ares_process_fd(channel, ARES_SOCKET_BAD, ARES_SOCKET_BAD);
+      }
+      continue;
+    }
+    for (size_t i = 0; i < pfds.size(); i++) {
+      short revents = pfds[i].revents;
+      if (revents == 0) {
+        continue;
+      }
+      if (owners[i] == nullptr) {
+        extra->ProcessFD(pfds[i].fd);
+      } else {
+        ares_process_fd(owners[i],
+                        (revents & (POLLIN | POLLERR | POLLHUP)) ? pfds[i].fd : ARES_SOCKET_BAD,
+                        (revents & POLLOUT) ? pfds[i].fd : ARES_SOCKET_BAD);
       }
     }
   }
@@ -230,6 +474,461 @@ VirtualizeIO::~VirtualizeIO() {
   ares_set_socket_functions(channel_, 0, 0);
 }
 
+SyscallCounter::SyscallCounter()
+  : sockets_(0), closes_(0), setsockopts_(0), connects_(0), recvs_(0),
+    sends_(0), getsocknames_(0), binds_(0) {
+}
+
+unsigned long long SyscallCounter::total() const {
+  return sockets_ + closes_ + setsockopts_ + connects_ + recvs_ + sends_ +
+         getsocknames_ + binds_;
+}
+
+static SyscallCounter *Counter(void *data) {
+  return reinterpret_cast<SyscallCounter *>(data);
+}
+
+static ares_socket_t CountSocket(int domain, int type, int protocol, void *data) {
+  Counter(data)->sockets_++;
+  ares_socket_t fd = socket(domain, type | SOCK_NONBLOCK | SOCK_CLOEXEC, protocol);
+  if (fd != ARES_SOCKET_BAD && type == SOCK_STREAM) {
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  }
+  return fd;
+}
+
+static int CountClose(ares_socket_t fd, void *data) {
+  Counter(data)->closes_++;
+  return close(fd);
+}
+
+static int CountSetsockopt(ares_socket_t fd, ares_socket_opt_t opt,
+                           const void *val, ares_socklen_t len, void *data) {
+  Counter(data)->setsockopts_++;
+  switch (opt) {
+    case ARES_SOCKET_OPT_SENDBUF_SIZE:
+      return setsockopt(fd, SOL_SOCKET, SO_SNDBUF, val, len);
+    case ARES_SOCKET_OPT_RECVBUF_SIZE:
+      return setsockopt(fd, SOL_SOCKET, SO_RCVBUF, val, len);
+    case ARES_SOCKET_OPT_BIND_DEVICE:
+      return setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, val, len);
+    default:
+      errno = ENOSYS;
+      return -1;
+  }
+}
+
+static int CountConnect(ares_socket_t fd, const struct sockaddr *addr,
+                        ares_socklen_t len, unsigned int flags, void *data) {
+  (void)flags;
+  Counter(data)->connects_++;
+  return connect(fd, addr, len);
+}
+
+static ares_ssize_t CountRecvfrom(ares_socket_t fd, void *buf, size_t len,
+                                  int flags, struct sockaddr *addr,
+                                  ares_socklen_t *addrlen, void *data) {
+  Counter(data)->recvs_++;
+  return recvfrom(fd, buf, len, flags, addr, addrlen);
+}
+
+static ares_ssize_t CountSendto(ares_socket_t fd, const void *buf, size_t len,
+                                int flags, const struct sockaddr *addr,
+                                ares_socklen_t addrlen, void *data) {
+  Counter(data)->sends_++;
+  return sendto(fd, buf, len, flags, addr, addrlen);
+}
+
+static int CountGetsockname(ares_socket_t fd, struct sockaddr *addr,
+                            ares_socklen_t *addrlen, void *data) {
+  Counter(data)->getsocknames_++;
+  return getsockname(fd, addr, addrlen);
+}
+
+static int CountBind(ares_socket_t fd, unsigned int flags,
+                     const struct sockaddr *addr, socklen_t addrlen, void *data) {
+  (void)flags;
+  Counter(data)->binds_++;
+  return bind(fd, addr, addrlen);
+}
+
+void SyscallCounter::Install(ares_channel_t *channel) {
+  static const struct ares_socket_functions_ex funcs = {
+    1, ARES_SOCKFUNC_FLAG_NONBLOCKING, CountSocket, CountClose, CountSetsockopt,
+    CountConnect, CountRecvfrom, CountSendto, CountGetsockname, CountBind,
+    NULL, NULL
+  };
+  EXPECT_EQ(ARES_SUCCESS, ares_set_socket_functions_ex(channel, &funcs, this));
+}
+
+static CountingAllocator::Counts allocator_counts;
+// Keyed by the shims' string literals, so pointer comparison is enough.
+static std::map<const char *, CountingAllocator::Counts> allocator_api_counts;
+
+static CountingAllocator::Counts &ApiCounts() {
+  return allocator_api_counts[impl_current_api ? impl_current_api : "(none)"];
+}
+
+static void CountLive(CountingAllocator::Counts *c, long long blocks, long long bytes) {
+  c->live_blocks_ += blocks;
+  c->live_bytes_ += bytes;
+  if (c->live_bytes_ > c->peak_bytes_) {
+    c->peak_bytes_ = c->live_bytes_;
+  }
+}
+
+static void CountRequest(CountingAllocator::Counts *c, size_t size) {
+  c->requested_bytes_ += size;
+  c->size_classes_[CountingAllocator::SizeClass(size)]++;
+}
+
+// Header in front of every pool and arena block, keeping the block at the
+// alignment malloc() gives.
+struct BlockHeader {
+  size_t size;   // usable size
+  size_t cls;    // pool size class, or kPoolClasses if from malloc()
+  size_t pad[2];
+};
+
+static const size_t kPoolClasses    = 13;          // 16 bytes to 64KiB
+static const size_t kPoolChunkBytes = 256 * 1024;
+static const size_t kArenaChunkBytes = 1024 * 1024;
+
+struct PoolState {
+  std::vector<BlockHeader *> free_[kPoolClasses];
+  std::vector<void *>        chunks_;
+  char                      *next_;
+  size_t                     left_;
+};
+
+struct ArenaState {
+  std::vector<void *> chunks_;   // the first one is kept across resets
+  std::vector<void *> large_;    // blocks too big for a chunk
+  size_t              used_;     // of the last chunk
+  BlockHeader        *last_;     // most recent block, which can grow in place
+};
+
+static thread_local PoolState  pool_state;
+static thread_local ArenaState arena_state;
+static CountingAllocator::Backend allocator_backend = CountingAllocator::kMalloc;
+
+static void *PoolAlloc(size_t size) {
+  size_t cls = 0;
+  while (cls < kPoolClasses && size > ((size_t)16 << cls)) {
+    cls++;
+  }
+  BlockHeader *block;
+  if (cls == kPoolClasses) {
+    block = (BlockHeader *)malloc(sizeof(BlockHeader) + size);
+    if (block == nullptr) {
+      return nullptr;
+    }
+    block->size = size;
+  } else if (!pool_state.free_[cls].empty()) {
+    block = pool_state.free_[cls].back();
+    pool_state.free_[cls].pop_back();
+  } else {
+    size_t need = sizeof(BlockHeader) + ((size_t)16 << cls);
+    if (pool_state.left_ < need) {
+      void *chunk = malloc(kPoolChunkBytes);
+      if (chunk == nullptr) {
+        return nullptr;
+      }
+      pool_state.chunks_.push_back(chunk);
+      pool_state.next_ = (char *)chunk;
+      pool_state.left_ = kPoolChunkBytes;
+    }
+    block = (BlockHeader *)pool_state.next_;
+    pool_state.next_ += need;
+    pool_state.left_ -= need;
+    block->size = (size_t)16 << cls;
+  }
+  block->cls = cls;
+  return block + 1;
+}
+
+static void PoolFree(void *ptr) {
+  BlockHeader *block = (BlockHeader *)ptr - 1;
+  if (block->cls == kPoolClasses) {
+    free(block);
+  } else {
+    pool_state.free_[block->cls].push_back(block);
+  }
+}
+
+static void PoolRelease() {
+  for (size_t i = 0; i < kPoolClasses; i++) {
+    pool_state.free_[i].clear();
+  }
+  for (void *chunk : pool_state.chunks_) {
+    free(chunk);
+  }
+  pool_state.chunks_.clear();
+  pool_state.next_ = nullptr;
+  pool_state.left_ = 0;
+}
+
+static void *ArenaAlloc(size_t size) {
+  size_t need = sizeof(BlockHeader) + ((size + 15) & ~(size_t)15);
+  BlockHeader *block;
+  if (need > kArenaChunkBytes) {
+    block = (BlockHeader *)malloc(need);
+    if (block == nullptr) {
+      return nullptr;
+    }
+    arena_state.large_.push_back(block);
+    block->size = need - sizeof(BlockHeader);
+    arena_state.last_ = nullptr;
+    return block + 1;
+  }
+  if (arena_state.chunks_.empty() || arena_state.used_ + need > kArenaChunkBytes) {
+    void *chunk = malloc(kArenaChunkBytes);
+    if (chunk == nullptr) {
+      return nullptr;
+    }
+    arena_state.chunks_.push_back(chunk);
+    arena_state.used_ = 0;
+  }
+  block = (BlockHeader *)((char *)arena_state.chunks_.back() + arena_state.used_);
+  arena_state.used_ += need;
+  block->size = need - sizeof(BlockHeader);
+  arena_state.last_ = block;
+  return block + 1;
+}
+
+static void *ArenaRealloc(void *ptr, size_t size) {
+  BlockHeader *block = (BlockHeader *)ptr - 1;
+  if (size <= block->size) {
+    return ptr;
+  }
+  size_t grow = ((size + 15) & ~(size_t)15) - block->size;
+  if (block == arena_state.last_ && arena_state.used_ + grow <= kArenaChunkBytes) {
+    // The most recent block grows in place.
+    arena_state.used_ += grow;
+    block->size += grow;
+    return ptr;
+  }
+  void *newptr = ArenaAlloc(size);
+  if (newptr) {
+    memcpy(newptr, ptr, block->size);
+  }
+  return newptr;
+}
+
+static void ArenaRelease(bool keep_first) {
+  size_t keep = (keep_first && !arena_state.chunks_.empty()) ? 1 : 0;
+  for (size_t i = keep; i < arena_state.chunks_.size(); i++) {
+    free(arena_state.chunks_[i]);
+  }
+  arena_state.chunks_.resize(keep);
+  for (void *block : arena_state.large_) {
+    free(block);
+  }
+  arena_state.large_.clear();
+  arena_state.used_ = 0;
+  arena_state.last_ = nullptr;
+}
+
+static size_t BlockSize(void *ptr) {
+  if (allocator_backend == CountingAllocator::kMalloc) {
+    return malloc_usable_size(ptr);
+  }
+  return ((BlockHeader *)ptr - 1)->size;
+}
+
+static void *BackendMalloc(size_t size) {
+  switch (allocator_backend) {
+    case CountingAllocator::kPool:
+      return PoolAlloc(size);
+    case CountingAllocator::kArena:
+      return ArenaAlloc(size);
+    default:
+      return malloc(size);
+  }
+}
+
+static void *BackendRealloc(void *ptr, size_t size) {
+  if (allocator_backend == CountingAllocator::kMalloc) {
+    return realloc(ptr, size);
+  }
+  if (ptr == nullptr) {
+    return BackendMalloc(size);
+  }
+  if (allocator_backend == CountingAllocator::kArena) {
+    return size ? ArenaRealloc(ptr, size) : nullptr;
+  }
+  if (size == 0) {
+    PoolFree(ptr);
+    return nullptr;
+  }
+  if (size <= BlockSize(ptr)) {
+    return ptr;
+  }
+  void *newptr = PoolAlloc(size);
+  if (newptr) {
+    memcpy(newptr, ptr, BlockSize(ptr));
+    PoolFree(ptr);
+  }
+  return newptr;
+}
+
+static void BackendFree(void *ptr) {
+  if (ptr == nullptr) {
+    return;
+  }
+  switch (allocator_backend) {
+    case CountingAllocator::kPool:
+      PoolFree(ptr);
+      break;
+    case CountingAllocator::kArena:
+      break;
+    default:
+      free(ptr);
+      break;
+  }
+}
+
+static void *CountingMalloc(size_t size) {
+  void *ptr = BackendMalloc(size);
+  if (ptr) {
+    long long usable = (long long)BlockSize(ptr);
+    for (CountingAllocator::Counts *c : {&allocator_counts, &ApiCounts()}) {
+      c->allocs_++;
+      CountRequest(c, size);
+      CountLive(c, 1, usable);
+    }
+  }
+  return ptr;
+}
+
+static void *CountingRealloc(void *ptr, size_t size) {
+  long long old_size = ptr ? (long long)BlockSize(ptr) : 0;
+  void *newptr = BackendRealloc(ptr, size);
+  if (newptr == nullptr && size != 0) {
+    return newptr;  // ptr is untouched
+  }
+  long long new_size = newptr ? (long long)BlockSize(newptr) : 0;
+  for (CountingAllocator::Counts *c : {&allocator_counts, &ApiCounts()}) {
+    c->reallocs_++;
+    CountRequest(c, size);
+    CountLive(c, (newptr ? 1 : 0) - (ptr ? 1 : 0), new_size - old_size);
+  }
+  return newptr;
+}
+
+static void CountingFree(void *ptr) {
+  if (ptr) {
+    long long usable = (long long)BlockSize(ptr);
+    for (CountingAllocator::Counts *c : {&allocator_counts, &ApiCounts()}) {
+      c->frees_++;
+      CountLive(c, -1, -usable);
+    }
+  }
+  BackendFree(ptr);
+}
+
+static bool allocator_installed = false;
+
+CountingAllocator::CountingAllocator(Backend backend) {
+  EXPECT_FALSE(allocator_installed);
+  allocator_installed = true;
+  allocator_backend = backend;
+  Reset();
+  EXPECT_EQ(ARES_SUCCESS, ares_library_init_mem(ARES_LIB_INIT_ALL, CountingMalloc,
+                                                CountingFree, CountingRealloc));
+}
+
+CountingAllocator::~CountingAllocator() {
+  // Dropping the last library reference puts back the default allocator.
+  ares_library_cleanup();
+  PoolRelease();
+  ArenaRelease(false);
+  allocator_backend = kMalloc;
+  allocator_installed = false;
+}
+
+const char *CountingAllocator::BackendName(Backend backend) {
+  switch (backend) {
+    case kPool:
+      return "pool";
+    case kArena:
+      return "arena";
+    default:
+      return "malloc";
+  }
+}
+
+void CountingAllocator::ResetArena() {
+  ArenaRelease(true);
+}
+
+const CountingAllocator::Counts &CountingAllocator::counts() {
+  return allocator_counts;
+}
+
+std::map<std::string, CountingAllocator::Counts> CountingAllocator::api_counts() {
+  std::map<std::string, Counts> result;
+  for (const auto &it : allocator_api_counts) {
+    result[it.first] = it.second;
+  }
+  return result;
+}
+
+void CountingAllocator::ResetPeak() {
+  allocator_counts.peak_bytes_ = allocator_counts.live_bytes_;
+}
+
+void CountingAllocator::Reset() {
+  allocator_counts = Counts();
+  allocator_api_counts.clear();
+}
+
+int CountingAllocator::SizeClass(size_t size) {
+  int cls = 0;
+  while (cls < kSizeClasses - 1 && size > ((size_t)16 << cls)) {
+    cls++;
+  }
+  return cls;
+}
+
+void HeapCheckListener::OnTestStart(const ::testing::TestInfo &info) {
+  (void)info;
+  CountingAllocator::ResetPeak();
+  start_ = CountingAllocator::counts();
+}
+
+void HeapCheckListener::OnTestEnd(const ::testing::TestInfo &info) {
+  const CountingAllocator::Counts &end = CountingAllocator::counts();
+  std::string name = std::string(info.test_suite_name()) + "." + info.name();
+  long long   blocks = end.live_blocks_ - start_.live_blocks_;
+  long long   bytes  = end.live_bytes_ - start_.live_bytes_;
+  if (!quiet_) {
+    std::cout << "[ HEAP     ] " << name
+              << " peak_bytes=" << (end.peak_bytes_ - start_.live_bytes_)
+              << " allocs=" << (end.allocs_ - start_.allocs_)
+              << " leaked_blocks=" << (blocks > 0 ? blocks : 0)
+              << " leaked_bytes=" << (bytes > 0 ? bytes : 0) << std::endl;
+  }
+  if (blocks > 0) {
+    Leak leak = {name, blocks, bytes};
+    leaked_.push_back(leak);
+  }
+}
+
+void HeapCheckListener::OnTestProgramEnd(const ::testing::UnitTest &unit) {
+  (void)unit;
+  if (quiet_ || leaked_.empty()) {
+    return;
+  }
+  std::cout << "[ HEAP     ] " << leaked_.size() << " test"
+            << (leaked_.size() == 1 ? "" : "s") << " leaked:" << std::endl;
+  for (const Leak &leak : leaked_) {
+    std::cout << "[ HEAP     ]   " << leak.name_ << " blocks=" << leak.blocks_
+              << " bytes=" << leak.bytes_ << std::endl;
+  }
+}
+
 void HostCallback(void *data, int status, int timeouts,
                   struct hostent *hostent) {
   EXPECT_NE(nullptr, data);
@@ -283,17 +982,47 @@ void AddrInfoCallback(void *data, int status, int timeouts,
 static constexpr unsigned short dynamic_port = 0;
 unsigned short mock_port = dynamic_port;
 
+// Default search domains for mock channels.
+static const char *mock_domains[3] = {"first.com", "second.org", "third.gov"};
+
 MockChannelOptsTest::MockChannelOptsTest(int count,
                                          int family,
                                          bool force_tcp,
                                          struct ares_options* givenopts,
                                          int optmask)
   : servers_(BuildServers(count, family, mock_port)),
-    server_(*servers_[0].get()), channel_(nullptr) {
+    server_(*servers_[0].get()), channel_(nullptr), family_(family),
+    fdcachegen_(0) {
   // Set up channel options.
-  struct ares_options opts;
+  struct ares_options &opts = chanopts_;
   if (givenopts) {
     memcpy(&opts, givenopts, sizeof(opts));
+    // NewChannel() reuses the options for as long as the fixture lives, so
+    // keep our own copies of what they point to.  struct apattern is opaque,
+    // so a sortlist cannot be copied.
+    if (opts.servers) {
+      serveraddrs_.assign(opts.servers, opts.servers + opts.nservers);
+      opts.servers = serveraddrs_.data();
+    }
+    if (opts.domains) {
+      domains_.assign(opts.domains, opts.domains + opts.ndomains);
+      for (std::string &domain : domains_) {
+        domainptrs_.push_back(&domain[0]);
+      }
+      opts.domains = domainptrs_.data();
+    }
+    if (opts.lookups) {
+      lookups_ = opts.lookups;
+      opts.lookups = &lookups_[0];
+    }
+    if (opts.resolvconf_path) {
+      resolvconf_path_ = opts.resolvconf_path;
+      opts.resolvconf_path = &resolvconf_path_[0];
+    }
+    if (opts.hosts_path) {
+      hosts_path_ = opts.hosts_path;
+      opts.hosts_path = &hosts_path_[0];
+    }
   } else {
     memset(&opts, 0, sizeof(opts));
   }
@@ -315,19 +1044,27 @@ MockChannelOptsTest::MockChannelOptsTest(int count,
     optmask |= ARES_OPT_TRIES;
   }
   // If not already overridden, set search domains.
-  const char *domains[3] = {"first.com", "second.org", "third.gov"};
   if (!(optmask & ARES_OPT_DOMAINS)) {
     opts.ndomains = 3;
-    opts.domains = (char**)domains;
+    opts.domains = (char**)mock_domains;
     optmask |= ARES_OPT_DOMAINS;
   }
   if (force_tcp) {
     opts.flags |= ARES_FLAG_USEVC;
     optmask |= ARES_OPT_FLAGS;
   }
+  chanoptmask_ = optmask;
 
-  EXPECT_EQ(ARES_SUCCESS, ares_init_options(&channel_, &opts, optmask));
-  EXPECT_NE(nullptr, channel_);
+  channel_ = NewChannel();
+}
+
+ares_channel_t *MockChannelOptsTest::NewChannel() {
+  ares_channel_t *channel = nullptr;
+  EXPECT_EQ(ARES_SUCCESS, ares_init_options(&channel, &chanopts_, chanoptmask_));
+  EXPECT_NE(nullptr, channel);
+  if (channel == nullptr) {
+    return nullptr;
+  }
 
   // Set up servers after construction so we can set individual ports
   struct ares_addr_port_node* prev = nullptr;
@@ -340,10 +1077,10 @@ MockChannelOptsTest::MockChannelOptsTest(int count,
       first = node;
     }
     node->next = nullptr;
-    node->family = family;
+    node->family = family_;
     node->udp_port = server->udpport();
     node->tcp_port = server->tcpport();
-    if (family == AF_INET) {
+    if (family_ == AF_INET) {
       node->addr.addr4.s_addr = htonl(0x7F000001);
     } else {
       memset(&node->addr.addr6, 0, sizeof(node->addr.addr6));
@@ -351,13 +1088,14 @@ MockChannelOptsTest::MockChannelOptsTest(int count,
     }
     prev = node;
   }
-  EXPECT_EQ(ARES_SUCCESS, ares_set_servers_ports(channel_, first));
+  EXPECT_EQ(ARES_SUCCESS, ares_set_servers_ports(channel, first));
 
   while (first) {
     prev = first;
     first = first->next;
     free(prev);
   }
+  return channel;
 }
 
 MockChannelOptsTest::~MockChannelOptsTest() {
@@ -394,11 +1132,7 @@ void MockChannelOptsTest::ProcessFD(ares_socket_t fd) {
 }
 
 void MockChannelOptsTest::Process(unsigned int cancel_ms) {
-  using namespace std::placeholders;
-  ProcessWork(channel_,
-              std::bind(&MockChannelOptsTest::fds, this),
-              std::bind(&MockChannelOptsTest::ProcessFD, this, _1),
-              cancel_ms);
+  ProcessWork(channel_, this, cancel_ms);
 }
 
 void MockServer::ProcessFD(ares_socket_t fd) {
@@ -412,6 +1146,7 @@ void MockServer::ProcessFD(ares_socket_t fd) {
       std::cerr << "Error accepting connection on fd " << fd << std::endl;
     } else {
       connfds_.insert(connfd);
+      fdsgen_++;
     }
     return;
   }
@@ -426,6 +1161,7 @@ void MockServer::ProcessFD(ares_socket_t fd) {
   if (fd != udpfd_) {
     if (len <= 0) {
       connfds_.erase(std::find(connfds_.begin(), connfds_.end(), fd));
+      fdsgen_++;
       close(fd);
       free(tcp_data_);
       tcp_data_ = NULL;
@@ -534,7 +1270,9 @@ void MockServer::ProcessPacket(ares_socket_t fd, struct sockaddr_storage *addr,
 }
 
 MockServer::MockServer(int family, unsigned short port)
-  : udpport_(port), tcpport_(port), qid_(-1) {
+  : udpport_(port), tcpport_(port), fdsgen_(0), qid_(-1), zone_(nullptr),
+    requests_(0), fail_rcode_(0), drop_requests_(false), delay_ms_(0),
+    fault_type_(0), transport_(nullptr) {
   // Create a TCP socket to receive data on.
   tcp_data_ = NULL;
   tcp_data_len_ = 0;
@@ -550,6 +1288,12 @@ MockServer::MockServer(int family, unsigned short port)
   // Create a UDP socket to receive data on.
   udpfd_ = socket(family, SOCK_DGRAM, 0);
   EXPECT_NE(ARES_SOCKET_BAD, udpfd_);
+  // Room for the bursts of thousands of queries that benchmarks send, so
+  // that they are not lost before the server gets to read them (the kernel
+  // caps this at net.core.rmem_max).
+  int rcvbuf = 4 * 1024 * 1024;
+  setsockopt(udpfd_, SOL_SOCKET, SO_RCVBUF,
+             &rcvbuf, sizeof(int));
 
   // Bind the sockets to the given port.
   if (family == AF_INET) {
@@ -633,8 +1377,62 @@ std::set<ares_socket_t> MockServer::fds() const {
   return result;
 }
 
+void MockServer::AppendFDs(std::vector<ares_socket_t> *fds) const {
+  fds->push_back(tcpfd_);
+  fds->push_back(udpfd_);
+  fds->insert(fds->end(), connfds_.begin(), connfds_.end());
+}
+
+const std::vector<ares_socket_t> &MockChannelOptsTest::CachedFDs() {
+  unsigned int gen = 0;
+  for (const auto& server : servers_) {
+    gen += server->fdsgen();
+  }
+  if (fdcache_.empty() || gen != fdcachegen_) {
+    fdcache_.clear();
+    for (const auto& server : servers_) {
+      server->AppendFDs(&fdcache_);
+    }
+    fdcachegen_ = gen;
+  }
+  return fdcache_;
+}
+
 void MockServer::ProcessRequest(ares_socket_t fd, struct sockaddr_storage* addr, ares_socklen_t addrlen,
                                 int qid, const std::string& name, int rrtype) {
+  requests_++;
+
+  if (zone_) {
+    bool fault = (fault_type_ == 0 || fault_type_ == rrtype);
+    if (fault && drop_requests_) {
+      return;
+    }
+    if (fault && fail_rcode_) {
+      // Header and question only.
+      static const byte header[NS_HFIXEDSZ] = {0, 0, 0x84, 0, 0, 1, 0, 0, 0, 0, 0, 0};
+      zonereply_.assign(header, header + NS_HFIXEDSZ);
+      zonereply_[3] = (byte)fail_rcode_;
+      PushName(&zonereply_, name);
+      PushInt16(&zonereply_, rrtype);
+      PushInt16(&zonereply_, C_IN);
+    } else if (!zone_->Answer(name, rrtype, &zonereply_)) {
+      return;
+    }
+    if (fault && delay_ms_) {
+      DelayedReply delayed;
+      delayed.fd_ = fd;
+      memcpy(&delayed.addr_, addr, addrlen);
+      delayed.addrlen_ = addrlen;
+      delayed.qid_ = qid;
+      delayed.reply_ = zonereply_;
+      delayed.due_ns_ = ProcessNowNs() + delay_ms_ * 1000000ULL;
+      delayed_.push_back(delayed);
+      return;
+    }
+    SendReply(fd, addr, addrlen, qid, &zonereply_);
+    return;
+  }
+
   // Before processing, let gMock know the request is happening.
   OnRequest(name, rrtype);
 
@@ -644,39 +1442,422 @@ void MockServer::ProcessRequest(ares_socket_t fd, struct sockaddr_storage* addr,
 
   // Make a local copy of the current pending reply.
   std::vector<byte> reply = reply_;
+  SendReply(fd, addr, addrlen, qid, &reply);
+}
+
+void MockServer::SendDelayedReplies() {
+  // Every reply is held back for the same time, so they fall due in order.
+  unsigned long long now = ProcessNowNs();
+  while (!delayed_.empty() && delayed_.front().due_ns_ <= now) {
+    DelayedReply &delayed = delayed_.front();
+    SendReply(delayed.fd_, &delayed.addr_, delayed.addrlen_, delayed.qid_,
+              &delayed.reply_);
+    delayed_.pop_front();
+  }
+}
 
+void MockServer::SendReply(ares_socket_t fd, struct sockaddr_storage* addr, ares_socklen_t addrlen,
+                           int qid, std::vector<byte>* reply) {
   if (qid_ >= 0) {
     // Use the explicitly specified query ID.
     qid = qid_;
   }
-  if (reply.size() >=  2) {
+  if (reply->size() >=  2) {
     // Overwrite the query ID if space to do so.
-    reply[0] = (byte)((qid >> 8) & 0xff);
-    reply[1] = (byte)(qid & 0xff);
+    (*reply)[0] = (byte)((qid >> 8) & 0xff);
+    (*reply)[1] = (byte)(qid & 0xff);
   }
   if (verbose) {
-    std::cerr << "sending reply " << PacketToString(reply)
+    std::cerr << "sending reply " << PacketToString(*reply)
               << " on port " << ((fd == udpfd_) ? udpport_ : tcpport_)
               << ":" << getaddrport(addr) << std::endl;
   }
 
+  if (transport_ && transport_->Deliver(fd, *reply)) {
+    return;
+  }
+
   // Prefix with 2-byte length if TCP.
   if (fd != udpfd_) {
-    int len = (int)reply.size();
+    int len = (int)reply->size();
     std::vector<byte> vlen = {(byte)((len & 0xFF00) >> 8), (byte)(len & 0xFF)};
-    reply.insert(reply.begin(), vlen.begin(), vlen.end());
+    reply->insert(reply->begin(), vlen.begin(), vlen.end());
     // Also, don't bother with the destination address.
     addr = nullptr;
     addrlen = 0;
   }
 
-  ares_ssize_t rc = (ares_ssize_t)sendto(fd, reply.data(), reply.size(), 0,
+  ares_ssize_t rc = (ares_ssize_t)sendto(fd, reply->data(), reply->size(), 0,
                   (struct sockaddr *)addr, addrlen);
-  if (rc < static_cast<ares_ssize_t>(reply.size())) {
+  if (rc < static_cast<ares_ssize_t>(reply->size())) {
     std::cerr << "Failed to send full reply, rc=" << rc << std::endl;
   }
 }
 
+void MockServer::DisconnectTransport() {
+  if (transport_) {
+    transport_->Disconnect(this);
+  }
+}
+
+InMemoryTransport::InMemoryTransport() : requests_(0), replies_(0) {
+}
+
+InMemoryTransport::~InMemoryTransport() {
+  for (MockServer *server : servers_) {
+    server->transport_ = nullptr;
+  }
+  for (const auto &sock : sockets_) {
+    close(sock.first);
+  }
+}
+
+void InMemoryTransport::AddServer(MockServer *server) {
+  servers_.push_back(server);
+  server->transport_ = this;
+}
+
+void InMemoryTransport::Install(ares_channel_t *channel) {
+  static const struct ares_socket_functions_ex funcs = {
+    1, ARES_SOCKFUNC_FLAG_NONBLOCKING, DoSocket, DoClose, DoSetsockopt,
+    DoConnect, DoRecvfrom, DoSendto, DoGetsockname, DoBind, NULL, NULL
+  };
+  EXPECT_EQ(ARES_SUCCESS, ares_set_socket_functions_ex(channel, &funcs, this));
+}
+
+void InMemoryTransport::Signal(ares_socket_t fd, Socket *sock) {
+  bool readable = sock->eof_ || !sock->replies_.empty();
+  if (readable == sock->signalled_) {
+    return;
+  }
+  uint64_t value = 1;
+  ares_ssize_t rc = readable ? write(fd, &value, sizeof(value))
+                             : read(fd, &value, sizeof(value));
+  EXPECT_EQ((ares_ssize_t)sizeof(value), rc);
+  sock->signalled_ = readable;
+}
+
+bool InMemoryTransport::Deliver(ares_socket_t fd, const std::vector<byte> &reply) {
+  auto it = sockets_.find(fd);
+  if (it == sockets_.end()) {
+    return false;
+  }
+  Socket &sock = it->second;
+  replies_++;
+  if (sock.type_ == SOCK_STREAM) {
+    if (sock.eof_) {
+      return true;
+    }
+    std::vector<byte> framed = {(byte)((reply.size() >> 8) & 0xff),
+                                (byte)(reply.size() & 0xff)};
+    framed.insert(framed.end(), reply.begin(), reply.end());
+    sock.replies_.push_back(framed);
+  } else {
+    sock.replies_.push_back(reply);
+  }
+  Signal(fd, &sock);
+  return true;
+}
+
+void InMemoryTransport::Disconnect(const MockServer *server) {
+  for (auto &it : sockets_) {
+    Socket &sock = it.second;
+    if (sock.type_ == SOCK_STREAM && sock.server_ == server) {
+      sock.eof_ = true;
+      sock.request_.clear();
+      Signal(it.first, &sock);
+    }
+  }
+}
+
+ares_socket_t InMemoryTransport::DoSocket(int domain, int type, int protocol,
+                                          void *data) {
+  (void)protocol;
+  InMemoryTransport *transport = reinterpret_cast<InMemoryTransport *>(data);
+  if (type != SOCK_DGRAM && type != SOCK_STREAM) {
+    errno = EPROTONOSUPPORT;
+    return ARES_SOCKET_BAD;
+  }
+  ares_socket_t fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd == ARES_SOCKET_BAD) {
+    return fd;
+  }
+  Socket &sock = transport->sockets_[fd];
+  sock.type_ = type;
+  sock.server_ = nullptr;
+  memset(&sock.self_, 0, sizeof(sock.self_));
+  memset(&sock.peer_, 0, sizeof(sock.peer_));
+  sock.peerlen_ = 0;
+  sock.offset_ = 0;
+  sock.eof_ = false;
+  sock.signalled_ = false;
+  // Loopback with a made up ephemeral port, for getsockname().
+  unsigned short port = (unsigned short)(32768 + fd % 28000);
+  if (domain == AF_INET6) {
+    struct sockaddr_in6 *self = (struct sockaddr_in6 *)(void *)&sock.self_;
+    self->sin6_family = AF_INET6;
+    self->sin6_addr.s6_addr[15] = 1;
+    self->sin6_port = htons(port);
+  } else {
+    struct sockaddr_in *self = (struct sockaddr_in *)(void *)&sock.self_;
+    self->sin_family = AF_INET;
+    self->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    self->sin_port = htons(port);
+  }
+  return fd;
+}
+
+int InMemoryTransport::DoClose(ares_socket_t fd, void *data) {
+  InMemoryTransport *transport = reinterpret_cast<InMemoryTransport *>(data);
+  transport->sockets_.erase(fd);
+  return close(fd);
+}
+
+int InMemoryTransport::DoSetsockopt(ares_socket_t fd, ares_socket_opt_t opt,
+                                    const void *val, ares_socklen_t len,
+                                    void *data) {
+  // Buffer sizes and devices mean nothing here.
+  (void)fd;
+  (void)opt;
+  (void)val;
+  (void)len;
+  (void)data;
+  return 0;
+}
+
+int InMemoryTransport::DoConnect(ares_socket_t fd, const struct sockaddr *addr,
+                                 ares_socklen_t len, unsigned int flags,
+                                 void *data) {
+  (void)flags;
+  InMemoryTransport *transport = reinterpret_cast<InMemoryTransport *>(data);
+  auto it = transport->sockets_.find(fd);
+  if (it == transport->sockets_.end() || len > sizeof(it->second.peer_)) {
+    errno = EBADF;
+    return -1;
+  }
+  Socket &sock = it->second;
+  unsigned short port = ntohs(addr->sa_family == AF_INET6
+                                ? ((const struct sockaddr_in6 *)(const void *)addr)->sin6_port
+                                : ((const struct sockaddr_in *)(const void *)addr)->sin_port);
+  sock.server_ = nullptr;
+  for (MockServer *server : transport->servers_) {
+    if ((sock.type_ == SOCK_STREAM ? server->tcpport() : server->udpport()) == port) {
+      sock.server_ = server;
+      break;
+    }
+  }
+  // Like the kernel, refuse a TCP connection that no server listens for,
+  // but let UDP requests to nowhere go unanswered.
+  if (sock.server_ == nullptr && sock.type_ == SOCK_STREAM) {
+    errno = ECONNREFUSED;
+    return -1;
+  }
+  memcpy(&sock.peer_, addr, len);
+  sock.peerlen_ = len;
+  return 0;
+}
+
+ares_ssize_t InMemoryTransport::DoRecvfrom(ares_socket_t fd, void *buf,
+                                           size_t len, int flags,
+                                           struct sockaddr *addr,
+                                           ares_socklen_t *addrlen, void *data) {
+  (void)flags;
+  InMemoryTransport *transport = reinterpret_cast<InMemoryTransport *>(data);
+  auto it = transport->sockets_.find(fd);
+  if (it == transport->sockets_.end()) {
+    errno = EBADF;
+    return -1;
+  }
+  Socket &sock = it->second;
+  if (sock.replies_.empty()) {
+    if (sock.eof_) {
+      return 0;
+    }
+    errno = EAGAIN;
+    return -1;
+  }
+  std::vector<byte> &front = sock.replies_.front();
+  size_t n;
+  if (sock.type_ == SOCK_STREAM) {
+    // A stream read takes as much as fits, and leaves the rest.
+    n = std::min(len, front.size() - sock.offset_);
+    memcpy(buf, front.data() + sock.offset_, n);
+    sock.offset_ += n;
+    if (sock.offset_ == front.size()) {
+      sock.replies_.pop_front();
+      sock.offset_ = 0;
+    }
+  } else {
+    // A datagram read takes the whole datagram, truncated to fit.
+    n = std::min(len, front.size());
+    memcpy(buf, front.data(), n);
+    sock.replies_.pop_front();
+    if (addr && addrlen) {
+      ares_socklen_t copy = std::min(*addrlen, sock.peerlen_);
+      memcpy(addr, &sock.peer_, copy);
+      *addrlen = sock.peerlen_;
+    }
+  }
+  transport->Signal(fd, &sock);
+  return (ares_ssize_t)n;
+}
+
+ares_ssize_t InMemoryTransport::DoSendto(ares_socket_t fd, const void *buf,
+                                         size_t len, int flags,
+                                         const struct sockaddr *addr,
+                                         ares_socklen_t addrlen, void *data) {
+  (void)flags;
+  (void)addr;
+  (void)addrlen;
+  InMemoryTransport *transport = reinterpret_cast<InMemoryTransport *>(data);
+  auto it = transport->sockets_.find(fd);
+  if (it == transport->sockets_.end()) {
+    errno = EBADF;
+    return -1;
+  }
+  Socket &sock = it->second;
+  if (sock.eof_) {
+    errno = EPIPE;
+    return -1;
+  }
+  MockServer *server = sock.server_;
+  if (server == nullptr) {
+    return (ares_ssize_t)len;
+  }
+  const byte *bytes = reinterpret_cast<const byte *>(buf);
+  if (sock.type_ != SOCK_STREAM) {
+    transport->requests_++;
+    std::vector<byte> packet(bytes, bytes + len);
+    server->ProcessPacket(fd, &sock.self_, sizeof(sock.self_), packet.data(),
+                          (int)packet.size());
+    return (ares_ssize_t)len;
+  }
+
+  // Split the stream into length-prefixed requests, as the server does
+  // for real connections.
+  sock.request_.insert(sock.request_.end(), bytes, bytes + len);
+  while (sock.request_.size() > 2) {
+    size_t tcplen = ((size_t)sock.request_[0] << 8) + (size_t)sock.request_[1];
+    if (sock.request_.size() - 2 < tcplen) {
+      break;
+    }
+    std::vector<byte> packet(sock.request_.begin() + 2,
+                             sock.request_.begin() + 2 + (ptrdiff_t)tcplen);
+    sock.request_.erase(sock.request_.begin(),
+                        sock.request_.begin() + 2 + (ptrdiff_t)tcplen);
+    transport->requests_++;
+    // The socket may be looked up again while the server answers, but
+    // std::map keeps references to it valid.
+    server->ProcessPacket(fd, &sock.self_, sizeof(sock.self_), packet.data(),
+                          (int)packet.size());
+    if (sock.eof_) {
+      break;
+    }
+  }
+  return (ares_ssize_t)len;
+}
+
+int InMemoryTransport::DoGetsockname(ares_socket_t fd, struct sockaddr *addr,
+                                     ares_socklen_t *addrlen, void *data) {
+  InMemoryTransport *transport = reinterpret_cast<InMemoryTransport *>(data);
+  auto it = transport->sockets_.find(fd);
+  if (it == transport->sockets_.end()) {
+    errno = EBADF;
+    return -1;
+  }
+  const struct sockaddr_storage &self = it->second.self_;
+  ares_socklen_t len = self.ss_family == AF_INET6 ? sizeof(struct sockaddr_in6)
+                                                  : sizeof(struct sockaddr_in);
+  memcpy(addr, &self, std::min(*addrlen, len));
+  *addrlen = len;
+  return 0;
+}
+
+int InMemoryTransport::DoBind(ares_socket_t fd, unsigned int flags,
+                              const struct sockaddr *addr, socklen_t addrlen,
+                              void *data) {
+  (void)fd;
+  (void)flags;
+  (void)addr;
+  (void)addrlen;
+  (void)data;
+  return 0;
+}
+
+MockZone &MockZone::Add(DNSRR *rr) {
+  std::unique_ptr<DNSRR> owned(rr);
+  std::string key = rr->name_;
+  std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+  RRSet &rrset = names_[key][rr->rrtype_];
+  std::vector<byte> data = rr->data();
+  rrset.data_.insert(rrset.data_.end(), data.begin(), data.end());
+  rrset.count_++;
+  return *this;
+}
+
+MockZone &MockZone::AddSOA(DNSSoaRR *soa) {
+  std::unique_ptr<DNSSoaRR> owned(soa);
+  std::string key = soa->name_;
+  std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+  if (!key.empty() && key.back() == '.')
+    key.pop_back();
+  soas_[key] = soa->data();
+  return *this;
+}
+
+int MockZone::Records(const std::string& name, int rrtype,
+                      std::vector<byte>* reply) const {
+  std::string key = name;
+  std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+  auto node = names_.find(key);
+  if (node == names_.end()) {
+    return -1;
+  }
+  auto rrset = node->second.find(rrtype);
+  if (rrset == node->second.end()) {
+    return 0;
+  }
+  reply->insert(reply->end(), rrset->second.data_.begin(), rrset->second.data_.end());
+  return rrset->second.count_;
+}
+
+bool MockZone::Answer(const std::string& name, int rrtype,
+                      std::vector<byte>* reply) const {
+  // Header: zero ID, QR and AA set, one question; counts patched below.
+  static const byte header[NS_HFIXEDSZ] = {0, 0, 0x84, 0, 0, 1, 0, 0, 0, 0, 0, 0};
+  reply->assign(header, header + NS_HFIXEDSZ);
+  PushName(reply, name);
+  PushInt16(reply, rrtype);
+  PushInt16(reply, C_IN);
+
+  int count = Records(name, rrtype, reply);
+  if (count < 0) {
+    (*reply)[3] = NXDOMAIN;
+  } else {
+    (*reply)[6] = (byte)((count >> 8) & 0xff);
+    (*reply)[7] = (byte)(count & 0xff);
+  }
+
+  if (count <= 0 && !soas_.empty()) {
+    // Find the closest enclosing apex, working up one label at a time.
+    std::string key = name;
+    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+    while (true) {
+      auto soa = soas_.find(key);
+      if (soa != soas_.end()) {
+        reply->insert(reply->end(), soa->second.begin(), soa->second.end());
+        (*reply)[9] = 1;
+        break;
+      }
+      if (key.empty())
+        break;
+      size_t dot = key.find('.');
+      key = (dot == std::string::npos) ? std::string() : key.substr(dot + 1);
+    }
+  }
+  return true;
+}
+
 std::ostream& operator<<(std::ostream& os, const AddrInfoResult& result) {
   os << '{';
   if (result.done_ && result.ai_) {
@@ -738,3 +1919,97 @@ std::ostream& operator<<(std::ostream& os, const AddrInfo& ai) {
   os << '}';
   return os;
 }
+
+EnvValue::EnvValue(const char *name, const char *value)
+  : name_(name), restore_(false) {
+  const char *original = getenv(name);
+  if (original) {
+    restore_  = true;
+    original_ = original;
+  }
+  if (value) {
+    setenv(name, value, 1);
+  } else {
+    unsetenv(name);
+  }
+}
+
+EnvValue::~EnvValue() {
+  if (restore_) {
+    setenv(name_.c_str(), original_.c_str(), 1);
+  } else {
+    unsetenv(name_.c_str());
+  }
+}
+
+static std::string MakeTempDir() {
+  char tmpl[] = "/tmp/ares-test-XXXXXX";
+  char *dir = mkdtemp(tmpl);
+  assert(dir);
+  return dir;
+}
+
+ConfigSandbox::ConfigSandbox()
+  : dir_(MakeTempDir()), resolvconf_(dir_ + "/resolv.conf"),
+    hosts_(dir_ + "/hosts"), nsswitch_(dir_ + "/nsswitch.conf"),
+    localdomain_("LOCALDOMAIN", nullptr), res_options_("RES_OPTIONS", nullptr),
+    cares_hosts_("CARES_HOSTS", hosts_.c_str()) {
+  WriteResolvConf("nameserver 127.0.0.1\n");
+  WriteHosts("127.0.0.1 localhost\n::1 localhost\n");
+  WriteNsswitch("hosts: files dns\n");
+}
+
+ConfigSandbox::~ConfigSandbox() {
+  unlink(resolvconf_.c_str());
+  unlink(hosts_.c_str());
+  unlink(nsswitch_.c_str());
+  rmdir(dir_.c_str());
+}
+
+void ConfigSandbox::WriteFile(const std::string &path, const std::string &contents) {
+  std::ofstream file(path.c_str(), std::ios::out | std::ios::trunc);
+  file << contents;
+  assert(file.good());
+}
+
+void ConfigSandbox::WriteResolvConf(const std::string &contents) {
+  WriteFile(resolvconf_, contents);
+}
+
+void ConfigSandbox::WriteHosts(const std::string &contents) {
+  WriteFile(hosts_, contents);
+}
+
+void ConfigSandbox::WriteNsswitch(const std::string &contents) {
+  WriteFile(nsswitch_, contents);
+
+  // Translate the "hosts:" sources into the library's lookup string.
+  lookups_.clear();
+  std::istringstream lines(contents);
+  std::string line;
+  while (std::getline(lines, line)) {
+    std::istringstream words(line);
+    std::string word;
+    if (!(words >> word) || word != "hosts:") {
+      continue;
+    }
+    while (words >> word) {
+      if (word == "files") {
+        lookups_ += 'f';
+      } else if (word == "dns") {
+        lookups_ += 'b';
+      }
+    }
+  }
+}
+
+int ConfigSandbox::Apply(struct ares_options *opts) const {
+  int optmask = ARES_OPT_RESOLVCONF | ARES_OPT_HOSTS_FILE;
+  opts->resolvconf_path = const_cast<char *>(resolvconf_.c_str());
+  opts->hosts_path      = const_cast<char *>(hosts_.c_str());
+  if (!lookups_.empty()) {
+    opts->lookups = const_cast<char *>(lookups_.c_str());
+    optmask |= ARES_OPT_LOOKUPS;
+  }
+  return optmask;
+}
@@ -1,5 +1,8 @@
 #pragma once
+#include <deque>
+#include <map>
 #include <ostream>
+#include <unordered_map>
 #include <vector>
 #include <netdb.h>
 
@@ -67,6 +70,143 @@ private:
   ares_channel_t *channel_;
 };
 
+// Socket functions for a channel that make the usual system calls and
+// count them, so that a benchmark can see how many a code path makes.
+// Unlike ares_set_socket_functions(), this provides getsockname() and
+// bind(), so the library behaves as it does with no functions installed.
+class SyscallCounter {
+public:
+  SyscallCounter();
+
+  // Route the channel's socket calls through this counter.  The counter
+  // must outlive the channel.
+  void               Install(ares_channel_t *channel);
+
+  unsigned long long total() const;
+
+  unsigned long long sockets_;
+  unsigned long long closes_;
+  unsigned long long setsockopts_;
+  unsigned long long connects_;
+  unsigned long long recvs_;
+  unsigned long long sends_;
+  unsigned long long getsocknames_;
+  unsigned long long binds_;
+};
+
+// Allocation hooks for the library, installed through
+// ares_library_init_mem() for the lifetime of the object, that count what
+// the library allocates.  Block sizes come from malloc_usable_size(), so no
+// header is needed and blocks may be freed with or without the hooks in
+// place.  Only one may exist at a time.
+//
+// The blocks can come from one of several backends, to see what a
+// different allocation strategy would buy the library.  The pool and arena
+// backends put a header in front of each block, so with those everything
+// the library allocates must be both allocated and freed while the hooks
+// are in place: create and destroy channels inside the allocator's scope.
+class CountingAllocator {
+public:
+  enum Backend {
+    // Plain malloc(), realloc() and free().
+    kMalloc,
+    // Per-thread free lists for each size class, carved from large chunks
+    // and never given back until the allocator goes away.
+    kPool,
+    // Per-thread bump allocator: free() does nothing, and ResetArena()
+    // releases everything at once.  Only suits work whose every block is
+    // freed before the reset, such as a parse call and the freeing of its
+    // result.
+    kArena
+  };
+
+  explicit CountingAllocator(Backend backend = kMalloc);
+  ~CountingAllocator();
+
+  static const char   *BackendName(Backend backend);
+
+  // Arena backend only: reuse all of the arena from the start.
+  static void          ResetArena();
+
+  // Requests of up to 16 << i bytes fall in size class i; the last class
+  // takes everything larger.
+  static const int kSizeClasses = 16;
+
+  struct Counts {
+    Counts()
+      : allocs_(0), reallocs_(0), frees_(0), requested_bytes_(0),
+        live_blocks_(0), live_bytes_(0), peak_bytes_(0)
+    {
+      for (int i = 0; i < kSizeClasses; i++)
+        size_classes_[i] = 0;
+    }
+
+    unsigned long long allocs_;
+    unsigned long long reallocs_;
+    unsigned long long frees_;
+    // Total asked for by malloc() and realloc() calls.
+    unsigned long long requested_bytes_;
+    // Blocks and usable bytes allocated and not yet freed.  Blocks freed
+    // through the hooks that were allocated before them make these go down,
+    // so compare snapshots rather than reading them as absolutes.
+    long long          live_blocks_;
+    long long          live_bytes_;
+    long long          peak_bytes_;
+    // malloc() and realloc() requests by size class.
+    unsigned long long size_classes_[kSizeClasses];
+  };
+
+  static const Counts &counts();
+
+  // The same counts split by the innermost library call that the loader's
+  // shims were running when the hook was called, e.g. "ares_process_fd";
+  // "(none)" for anything outside them.
+  static std::map<std::string, Counts> api_counts();
+
+  // Restart the peak from the current live bytes.
+  static void          ResetPeak();
+
+  // Zero every count, including the per-call ones.
+  static void          Reset();
+
+  // Size class for a request of size bytes.
+  static int           SizeClass(size_t size);
+};
+
+// gtest listener that checks, around every test, what the library still
+// holds once the test and its fixture are gone, and the most it held at
+// once while the test ran.  Needs a CountingAllocator in place for the
+// whole run.  Unless quiet, prints one line per test, and a summary of the
+// tests that leaked at the end of the run.
+class HeapCheckListener : public ::testing::EmptyTestEventListener {
+public:
+  struct Leak {
+    std::string name_;
+    long long   blocks_;
+    long long   bytes_;
+  };
+
+  explicit HeapCheckListener(bool quiet = false) : quiet_(quiet)
+  {
+  }
+
+  void OnTestStart(const ::testing::TestInfo &info) override;
+  void OnTestEnd(const ::testing::TestInfo &info) override;
+  void OnTestProgramEnd(const ::testing::UnitTest &unit) override;
+
+  // Tests that ended with more of the library's blocks live than they
+  // started with.
+  const std::vector<Leak> &leaked() const
+  {
+    return leaked_;
+  }
+
+private:
+  bool                      quiet_;
+  CountingAllocator::Counts start_;
+  std::vector<Leak>         leaked_;
+};
+
 #include "loader.h"
 
 class LibraryTest : public ::testing::Test {
@@ -172,10 +312,122 @@ void NameInfoCallback(void *data, int status, int timeouts, char *node,
 
 std::set<ares_socket_t> NoExtraFDs();
 
+// Source of extra file descriptors for the allocation-free ProcessWork()
+// variant.  The list is owned by the implementation and is expected to be
+// cached between calls, only being rebuilt once it has been invalidated.
+class ExtraFDs {
+public:
+  virtual ~ExtraFDs()
+  {
+  }
+
+  // Descriptors to watch for reading; valid until the next call.
+  virtual const std::vector<ares_socket_t> &CachedFDs() = 0;
+
+  // Process activity on one of the descriptors returned by CachedFDs().
+  virtual void ProcessFD(ares_socket_t fd) = 0;
+};
+
+// Time accounting for ProcessWork().  harness_ns_ is the time spent in the
+// driver itself, i.e. excluding the library, select() and the extra FD
+// handlers.
+struct ProcessStats {
+  ProcessStats() : iterations_(0), total_ns_(0), harness_ns_(0)
+  {
+  }
+
+  unsigned long      iterations_;
+  unsigned long long total_ns_;
+  unsigned long long harness_ns_;
+};
+
+void ProcessWork(ares_channel_t *channel, ExtraFDs *extra,
+                 unsigned int cancel_ms = 0, ProcessStats *stats = nullptr);
+
+// Run a single iteration of the ProcessWork() loop, waiting no longer than
+// maxtv (if given).  Returns false once the library has no work left.
+bool ProcessStep(ares_channel_t *channel, ExtraFDs *extra,
+                 struct timeval *maxtv = nullptr, ProcessStats *stats = nullptr);
+
+// Process all pending work on a set of channels at once.  Uses poll() with
+// ares_getsock()/ares_process_fd() rather than select(), so the number of
+// open sockets is not limited by FD_SETSIZE.
+void ProcessChannels(const std::vector<ares_channel_t *> &channels,
+                     ExtraFDs *extra);
+
+// Simulated time for timeout and retry tests.  While one of these is
+// alive, ProcessStep() and ProcessChannels() never wait for the library's
+// next timeout: whenever no descriptor is ready they move the clock forward
+// to it instead.  The harness overrides clock_gettime() for the process, so
+// the library and the harness both see the moved monotonic clocks;
+// CLOCK_REALTIME, CLOCK_MONOTONIC_RAW and the CPU clocks are left alone, so
+// real time can still be measured.  When the last one is destroyed the
+// clocks go back to real time, so channels that ran on simulated time
+// should not have queries pending by then.
+class VirtualClock {
+public:
+  VirtualClock();
+  ~VirtualClock();
+
+  static bool               enabled();
+
+  // Move the clock forward.
+  static void               Advance(unsigned long long ns);
+
+  // Total time skipped by the VirtualClocks alive now.
+  static unsigned long long skipped_ns();
+};
+
 void ProcessWork(ares_channel_t *channel,
    std::function<std::set<ares_socket_t>()> get_extrafds,
    std::function<void(ares_socket_t)> process_extra,
-   unsigned int cancel_ms = 0);
+   unsigned int cancel_ms = 0, ProcessStats *stats = nullptr);
+
+// In-memory zone that a MockServer can answer from instead of a single
+// canned reply, so that one server can serve any number of names.
+class MockZone {
+public:
+  virtual ~MockZone()
+  {
+  }
+
+  // Add a record to the zone.  Takes ownership of the given pointer.
+  MockZone &Add(DNSRR *rr);
+
+  // Add the SOA for a zone apex (or "" for the root).  NXDOMAIN and NODATA
+  // answers carry the SOA of the closest enclosing apex in their authority
+  // section, which is what lets resolvers cache them.  Takes ownership of
+  // the given pointer.
+  MockZone &AddSOA(DNSSoaRR *soa);
+
+  // Encode the response to a query for <name, rrtype> into *reply, with a
+  // zero query ID.  Names with no records at all get NXDOMAIN, names that
+  // only have records of other types get an empty NOERROR answer.  Returns
+  // false if the query should go unanswered.
+  virtual bool Answer(const std::string &name, int rrtype,
+                      std::vector<byte> *reply) const;
+
+protected:
+  // Append the encoded answer records for <name, rrtype> to *reply and
+  // return how many were added, or -1 if the name does not exist.
+  virtual int Records(const std::string &name, int rrtype,
+                      std::vector<byte> *reply) const;
+
+private:
+  struct RRSet {
+    RRSet() : count_(0)
+    {
+    }
+
+    int               count_;
+    std::vector<byte> data_;
+  };
+
+  std::unordered_map<std::string, std::map<int, RRSet>> names_;
+  std::unordered_map<std::string, std::vector<byte>>    soas_;
+};
+
+class InMemoryTransport;
 
 class MockServer {
 public:
@@ -203,20 +455,76 @@ public:
     qid_ = qid;
   }
 
+  // Answer every request from the given zone rather than the canned reply.
+  // Zone-backed requests are not passed to OnRequest(), so that gMock stays
+  // out of the way of benchmarks; use requests() to count them instead.
+  void SetZone(const MockZone *zone)
+  {
+    zone_ = zone;
+  }
+
+  // Failure injection for zone-backed requests, for failover benchmarks.
+  // A non-zero rcode (SERVFAIL, NOTIMP, REFUSED...) answers every request
+  // with that rcode and no records.
+  void SetFailRcode(int rcode)
+  {
+    fail_rcode_ = rcode;
+  }
+
+  // Read requests but never answer them.
+  void SetDropRequests(bool drop)
+  {
+    drop_requests_ = drop;
+  }
+
+  // Hold answers back for delay_ms.  Held answers are only sent by
+  // SendDelayedReplies(), which the caller must keep calling while it
+  // waits, e.g. between ProcessStep() calls with a short maxtv.
+  void SetReplyDelay(unsigned int delay_ms)
+  {
+    delay_ms_ = delay_ms;
+  }
+
+  void SendDelayedReplies();
+
+  // Apply the faults above only to requests of the given type, or to all
+  // requests if rrtype is 0.
+  void SetFaultType(int rrtype)
+  {
+    fault_type_ = rrtype;
+  }
+
+  // Number of requests received.
+  unsigned long requests() const
+  {
+    return requests_;
+  }
+
   void Disconnect()
   {
     for (ares_socket_t fd : connfds_) {
       close(fd);
     }
     connfds_.clear();
+    fdsgen_++;
     free(tcp_data_);
     tcp_data_     = NULL;
     tcp_data_len_ = 0;
+    DisconnectTransport();
   }
 
   // The set of file descriptors that the server handles.
   std::set<ares_socket_t> fds() const;
 
+  // Append the server's file descriptors to *fds without building a set.
+  void                    AppendFDs(std::vector<ares_socket_t> *fds) const;
+
+  // Bumped whenever the set of file descriptors changes.
+  unsigned int            fdsgen() const
+  {
+    return fdsgen_;
+  }
+
   // Process activity on a file descriptor.
   void                    ProcessFD(ares_socket_t fd);
 
@@ -232,23 +540,136 @@ public:
   }
 
 private:
+  friend class InMemoryTransport;
+
+  void           DisconnectTransport();
   void           ProcessRequest(ares_socket_t fd, struct sockaddr_storage *addr,
                                 ares_socklen_t addrlen, int qid, const std::string &name,
                                 int rrtype);
   void           ProcessPacket(ares_socket_t fd, struct sockaddr_storage *addr,
                                ares_socklen_t addrlen, byte *data, int len);
+  void           SendReply(ares_socket_t fd, struct sockaddr_storage *addr,
+                           ares_socklen_t addrlen, int qid,
+                           std::vector<byte> *reply);
+
+  struct DelayedReply {
+    ares_socket_t           fd_;
+    struct sockaddr_storage addr_;
+    ares_socklen_t          addrlen_;
+    int                     qid_;
+    std::vector<byte>       reply_;
+    unsigned long long      due_ns_;
+  };
+
   unsigned short udpport_;
   unsigned short tcpport_;
   ares_socket_t  udpfd_;
   ares_socket_t  tcpfd_;
   std::set<ares_socket_t> connfds_;
+  unsigned int            fdsgen_;
   std::vector<byte>       reply_;
   int                     qid_;
+  const MockZone         *zone_;
+  std::vector<byte>       zonereply_;
+  unsigned long           requests_;
+  int                     fail_rcode_;
+  bool                    drop_requests_;
+  unsigned int            delay_ms_;
+  int                     fault_type_;
+  std::deque<DelayedReply> delayed_;
   unsigned char          *tcp_data_;
   size_t                  tcp_data_len_;
+  InMemoryTransport      *transport_;
+};
+
+// Socket functions for a channel that keep its traffic inside the process.
+// Every socket is an eventfd, so that it can be waited on like any other
+// file descriptor; a request is handed straight to the MockServer on the
+// port it is sent to, and the reply is queued on the socket, which is
+// readable while anything is queued.  Nothing goes through the kernel
+// network stack, so benchmarks see only the library's own costs.
+class InMemoryTransport {
+public:
+  InMemoryTransport();
+  ~InMemoryTransport();
+
+  // Answer requests sent to the server's UDP and TCP ports.  The server
+  // must outlive the transport.
+  void               AddServer(MockServer *server);
+
+  // Route the channel's socket calls through this transport.  The transport
+  // must outlive the channel.
+  void               Install(ares_channel_t *channel);
+
+  // Number of sockets currently open.
+  size_t             sockets() const
+  {
+    return sockets_.size();
+  }
+
+  // Packets carried each way.
+  unsigned long long requests() const
+  {
+    return requests_;
+  }
+
+  unsigned long long replies() const
+  {
+    return replies_;
+  }
+
+private:
+  friend class MockServer;
+
+  struct Socket {
+    int                           type_;
+    MockServer                   *server_;
+    struct sockaddr_storage       self_;
+    struct sockaddr_storage       peer_;
+    ares_socklen_t                peerlen_;
+    // Datagrams for UDP, or chunks of the stream for TCP.
+    std::deque<std::vector<byte>> replies_;
+    size_t                        offset_;
+    // Partial TCP request.
+    std::vector<byte>             request_;
+    bool                          eof_;
+    bool                          signalled_;
+  };
+
+  // Queue a reply from a server on one of our sockets.  Returns false if
+  // fd is not one of ours.
+  bool Deliver(ares_socket_t fd, const std::vector<byte> &reply);
+  // End every TCP stream to the server, as if it had closed them.
+  void Disconnect(const MockServer *server);
+  // Make the socket's eventfd readable exactly while there is something to
+  // read.
+  void Signal(ares_socket_t fd, Socket *sock);
+
+  static ares_socket_t DoSocket(int domain, int type, int protocol, void *data);
+  static int           DoClose(ares_socket_t fd, void *data);
+  static int           DoSetsockopt(ares_socket_t fd, ares_socket_opt_t opt,
+                                    const void *val, ares_socklen_t len, void *data);
+  static int           DoConnect(ares_socket_t fd, const struct sockaddr *addr,
+                                 ares_socklen_t len, unsigned int flags, void *data);
+  static ares_ssize_t  DoRecvfrom(ares_socket_t fd, void *buf, size_t len,
+                                  int flags, struct sockaddr *addr,
+                                  ares_socklen_t *addrlen, void *data);
+  static ares_ssize_t  DoSendto(ares_socket_t fd, const void *buf, size_t len,
+                                int flags, const struct sockaddr *addr,
+                                ares_socklen_t addrlen, void *data);
+  static int           DoGetsockname(ares_socket_t fd, struct sockaddr *addr,
+                                     ares_socklen_t *addrlen, void *data);
+  static int           DoBind(ares_socket_t fd, unsigned int flags,
+                              const struct sockaddr *addr, socklen_t addrlen,
+                              void *data);
+
+  std::vector<MockServer *>         servers_;
+  std::map<ares_socket_t, Socket>   sockets_;
+  unsigned long long                requests_;
+  unsigned long long                replies_;
 };
 
-class MockChannelOptsTest : public LibraryTest {
+class MockChannelOptsTest : public LibraryTest, public ExtraFDs {
 public:
   MockChannelOptsTest(int count, int family, bool force_tcp,
                       struct ares_options *givenopts, int optmask);
@@ -258,6 +679,12 @@ public:
   // descriptors.
   void Process(unsigned int cancel_ms = 0);
 
+  // Create another channel with the same options and mock servers as
+  // channel_.  The caller owns the result.  The options are copied at
+  // construction, along with the lists and strings they point to; only a
+  // sortlist, whose type is opaque, must outlive the fixture.
+  ares_channel_t *NewChannel();
+
 protected:
   // NiceMockServer doesn't complain about uninteresting calls.
   typedef testing::NiceMock<MockServer>                NiceMockServer;
@@ -266,6 +693,10 @@ protected:
   std::set<ares_socket_t>                              fds() const;
   void                   ProcessFD(ares_socket_t fd);
 
+  // Cached union of the mock servers' file descriptors, rebuilt only when
+  // one of the servers reports a change.
+  const std::vector<ares_socket_t> &CachedFDs();
+
   static NiceMockServers BuildServers(int count, int family,
                                       unsigned short base_port);
 
@@ -273,6 +704,20 @@ protected:
   // Convenience reference to first server.
   NiceMockServer        &server_;
   ares_channel_t        *channel_;
+
+private:
+  int                         family_;
+  struct ares_options         chanopts_;
+  int                         chanoptmask_;
+  // Copies of what the given options pointed to, which chanopts_ points at.
+  std::vector<std::string>    domains_;
+  std::vector<char *>         domainptrs_;
+  std::vector<struct in_addr> serveraddrs_;
+  std::string                 lookups_;
+  std::string                 resolvconf_path_;
+  std::string                 hosts_path_;
+  std::vector<ares_socket_t>  fdcache_;
+  unsigned int                fdcachegen_;
 };
 
 struct AddrInfoDeleter {                                                                                                                   
@@ -318,3 +763,59 @@ ACTION_P2(SetReply, mockserver, reply)
 {
   mockserver->SetReply(reply);
 }
+
+// Set an environment variable (or unset it, for a null value) for the
+// lifetime of the object, restoring the original value afterwards.
+class EnvValue {
+public:
+  EnvValue(const char *name, const char *value);
+  ~EnvValue();
+
+private:
+  std::string name_;
+  bool        restore_;
+  std::string original_;
+};
+
+// Resolver configuration files generated in a temporary directory, so that
+// channel initialisation does not depend on the host's /etc.  Apply() points
+// a channel's options at them; the hosts file is also exported through
+// CARES_HOSTS, and LOCALDOMAIN and RES_OPTIONS are cleared so that nothing
+// leaks in from the environment.
+class ConfigSandbox {
+public:
+  ConfigSandbox();
+  ~ConfigSandbox();
+
+  void               WriteResolvConf(const std::string &contents);
+  void               WriteHosts(const std::string &contents);
+  void               WriteNsswitch(const std::string &contents);
+
+  const std::string &resolvconf_path() const
+  {
+    return resolvconf_;
+  }
+
+  const std::string &hosts_path() const
+  {
+    return hosts_;
+  }
+
+  // Set the paths (and lookup order) in *opts and return the option mask
+  // bits to add.  The library has no option for an nsswitch.conf path, so
+  // its "hosts:" line is passed on as ARES_OPT_LOOKUPS instead.  The
+  // strings stay owned by the sandbox.
+  int                Apply(struct ares_options *opts) const;
+
+private:
+  static void WriteFile(const std::string &path, const std::string &contents);
+
+  std::string dir_;
+  std::string resolvconf_;
+  std::string hosts_;
+  std::string nsswitch_;
+  std::string lookups_;
+  EnvValue    localdomain_;
+  EnvValue    res_options_;
+  EnvValue    cares_hosts_;
+};
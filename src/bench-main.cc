@@ -0,0 +1,31 @@
+#include <iostream>
+#include <cstring>
+#include "ares-test.h"
+#include "ares-bench.h"
+
+static void usage() {
+  fprintf(stderr, "Usage: arestest_bench [gtest flags] <libcares.so> [--bench_max=N] [--bench_perf]\n");
+  exit(-1);
+}
+
+int main(int argc, char **argv) {
+    ::testing::InitGoogleTest(&argc, argv);
+    if(argc < 2) {
+        usage();
+    }
+    for (int i = 2; i < argc; i++) {
+        if (strncmp(argv[i], "--bench_max=", 12) == 0) {
+            bench_max_n = (size_t)strtoull(argv[i] + 12, NULL, 10);
+        } else if (strcmp(argv[i], "--bench_perf") == 0) {
+            bench_perf = true;
+        } else {
+            usage();
+        }
+    }
+    const char *slash = strrchr(argv[1], '/');
+    bench_impl = slash ? slash + 1 : argv[1];
+    load_cares_impl(argv[1]);
+    int res = RUN_ALL_TESTS();
+    unload_cares_impl();
+    return res;
+}
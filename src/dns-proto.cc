@@ -165,6 +165,23 @@ void PushInt16(std::vector<byte>* data, int value) {
   data->push_back((byte)value & 0x00ff);
 }
 
+// Append an uncompressed encoded name; same output as EncodeString() but
+// without building a temporary vector.
+void PushName(std::vector<byte>* data, const std::string& name) {
+  size_t start = 0;
+  while (start < name.size()) {
+    size_t end = name.find('.', start);
+    if (end == std::string::npos)
+      end = name.size();
+    if (end == start)
+      break;
+    data->push_back((byte)(end - start));
+    data->insert(data->end(), name.begin() + (long)start, name.begin() + (long)end);
+    start = end + 1;
+  }
+  data->push_back(0);
+}
+
 std::vector<byte> EncodeString(const std::string& name) {
   std::vector<byte> data;
   std::stringstream ss(name);
@@ -252,6 +269,17 @@ std::vector<byte> DNSUriRR::data() const {
   return data;
 }
 
+std::vector<byte> DNSCaaRR::data() const {
+  std::vector<byte> data = DNSRR::data();
+  int len = 2 + (int)tag_.size() + (int)value_.size();
+  PushInt16(&data, len);
+  data.push_back((byte)flags_);
+  data.push_back((byte)tag_.size());
+  data.insert(data.end(), tag_.begin(), tag_.end());
+  data.insert(data.end(), value_.begin(), value_.end());
+  return data;
+}
+
 std::vector<byte> DNSAddressRR::data() const {
   std::vector<byte> data = DNSRR::data();
   int len = (int)addr_.size();
@@ -378,6 +406,28 @@ std::string AddressToString(const void* vaddr, int len) {
   return ss.str();
 }
 
+std::string ReverseLookupName(const void* vaddr, int len) {
+  static const char hex[] = "0123456789abcdef";
+  const byte* addr = reinterpret_cast<const byte*>(vaddr);
+  std::string name;
+  if (len == 4) {
+    for (int ii = 3; ii >= 0; ii--) {
+      name += std::to_string(addr[ii]);
+      name += '.';
+    }
+    name += "in-addr.arpa";
+  } else {
+    for (int ii = len - 1; ii >= 0; ii--) {
+      name += hex[addr[ii] & 0xf];
+      name += '.';
+      name += hex[addr[ii] >> 4];
+      name += '.';
+    }
+    name += "ip6.arpa";
+  }
+  return name;
+}
+
 std::string HexDump(std::vector<byte> data) {
   std::stringstream ss;
   for (size_t ii = 0; ii < data.size();  ii++) {
@@ -31,6 +31,9 @@ std::string           RcodeToString(int rcode);
 std::string           RRTypeToString(int rrtype);
 std::string           ClassToString(int qclass);
 std::string           AddressToString(const void *addr, int len);
+// Name to query for a PTR lookup of a 4-byte (in-addr.arpa) or 16-byte
+// (ip6.arpa) address.
+std::string           ReverseLookupName(const void *addr, int len);
 
 // Convert DNS protocol data to strings.
 // Note that these functions are not defensive; they assume
@@ -46,6 +49,7 @@ std::string RRToString(const std::vector<byte> &packet, const byte **data,
 // Manipulate DNS protocol data.
 void        PushInt32(std::vector<byte> *data, int value);
 void        PushInt16(std::vector<byte> *data, int value);
+void        PushName(std::vector<byte> *data, const std::string &name);
 std::vector<byte> EncodeString(const std::string &name);
 
 struct DNSQuestion {
@@ -211,6 +215,19 @@ struct DNSUriRR : public DNSRR {
   std::string               target_;
 };
 
+struct DNSCaaRR : public DNSRR {
+  DNSCaaRR(const std::string &name, int ttl, int flags, const std::string &tag,
+           const std::string &value)
+    : DNSRR(name, T_CAA, ttl), flags_(flags), tag_(tag), value_(value)
+  {
+  }
+
+  virtual std::vector<byte> data() const;
+  int                       flags_;
+  std::string               tag_;
+  std::string               value_;
+};
+
 struct DNSSoaRR : public DNSRR {
   DNSSoaRR(const std::string &name, int ttl, const std::string &nsname,
            const std::string &rname, int serial, int refresh, int retry,
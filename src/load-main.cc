@@ -0,0 +1,141 @@
+#include <iostream>
+#include <cstring>
+#include "ares-test.h"
+#include "ares-load.h"
+
+static LoadOptions         load_options;
+// Open loop rates to step through; empty for a single closed loop run.
+static std::vector<double> load_rates;
+
+// Runs the configured load against a single mock server answering from a
+// LoadZone under the channel's first search domain.
+class LoadTest : public MockChannelOptsTest {
+public:
+  LoadTest() : MockChannelOptsTest(1, AF_INET, false, nullptr, 0),
+               zone_("first.com", load_options.ttl_min, load_options.ttl_max)
+  {
+    server_.SetZone(&zone_);
+  }
+
+protected:
+  LoadZone zone_;
+};
+
+TEST_F(LoadTest, Run) {
+  std::vector<double> rates = load_rates;
+  if (rates.empty())
+    rates.push_back(0);
+  for (double rate : rates) {
+    LoadOptions opts = load_options;
+    opts.rate = rate;
+    LoadGenerator gen(opts, "first.com");
+    LoadResult result = gen.Run(channel_, this);
+    EXPECT_LT(0ULL, result.completed_);
+    EXPECT_EQ(0ULL, result.failed_);
+
+    BenchRecord record("Load");
+    record.Set("mode", rate > 0 ? "open" : "closed")
+      .Set("api", opts.api)
+      .Set("outstanding", opts.outstanding)
+      .Set("names", opts.names)
+      .Set("duration_ms", opts.duration_ms);
+    if (opts.zipf > 0)
+      record.Set("zipf", opts.zipf);
+    if (rate > 0)
+      record.Set("rate", rate);
+    result.Report(record).Report();
+  }
+}
+
+static void usage() {
+  fprintf(stderr, "Usage: arestest_load [gtest flags] <libcares.so> [options]\n"
+                  "  --api=getaddrinfo|gethostbyname|search|gethostbyaddr|getnameinfo\n"
+                  "  --family=inet|inet6|unspec\n"
+                  "  --outstanding=N    queries kept in flight (closed loop), or the\n"
+                  "                     most allowed in flight (open loop, default 32768)\n"
+                  "  --rate=QPS[,QPS..] issue at a fixed rate instead (open loop)\n"
+                  "  --duration=MS      length of the run\n"
+                  "  --names=N          distinct names to query\n"
+                  "  --zipf=S           pick names with Zipf exponent S, not in order\n"
+                  "  --ttl=MIN[-MAX]    TTL range of the answers\n");
+  exit(-1);
+}
+
+static const char *option(const char *arg, const char *name) {
+  size_t len = strlen(name);
+  if (strncmp(arg, name, len) == 0 && arg[len] == '=')
+    return arg + len + 1;
+  return nullptr;
+}
+
+int main(int argc, char **argv) {
+    bool outstanding_set = false;
+    ::testing::InitGoogleTest(&argc, argv);
+    if(argc < 2) {
+        usage();
+    }
+    for (int i = 2; i < argc; i++) {
+        const char *value;
+        if ((value = option(argv[i], "--api")) != nullptr) {
+            load_options.api = value;
+            if (load_options.api != "getaddrinfo" &&
+                load_options.api != "gethostbyname" &&
+                load_options.api != "search" &&
+                load_options.api != "gethostbyaddr" &&
+                load_options.api != "getnameinfo") {
+                usage();
+            }
+        } else if ((value = option(argv[i], "--family")) != nullptr) {
+            if (strcmp(value, "inet") == 0) {
+                load_options.family = AF_INET;
+            } else if (strcmp(value, "inet6") == 0) {
+                load_options.family = AF_INET6;
+            } else if (strcmp(value, "unspec") == 0) {
+                load_options.family = AF_UNSPEC;
+            } else {
+                usage();
+            }
+        } else if ((value = option(argv[i], "--outstanding")) != nullptr) {
+            load_options.outstanding = (size_t)strtoull(value, NULL, 10);
+            outstanding_set = true;
+        } else if ((value = option(argv[i], "--rate")) != nullptr) {
+            char *end;
+            do {
+                double rate = strtod(value, &end);
+                if (end == value || rate <= 0) {
+                    usage();
+                }
+                load_rates.push_back(rate);
+                value = end + 1;
+            } while (*end == ',');
+        } else if ((value = option(argv[i], "--duration")) != nullptr) {
+            load_options.duration_ms = (unsigned int)strtoul(value, NULL, 10);
+        } else if ((value = option(argv[i], "--names")) != nullptr) {
+            load_options.names = (size_t)strtoull(value, NULL, 10);
+        } else if ((value = option(argv[i], "--zipf")) != nullptr) {
+            load_options.zipf = strtod(value, NULL);
+        } else if ((value = option(argv[i], "--ttl")) != nullptr) {
+            char *end;
+            load_options.ttl_min = (unsigned int)strtoul(value, &end, 10);
+            load_options.ttl_max = (*end == '-') ? (unsigned int)strtoul(end + 1, NULL, 10)
+                                                 : load_options.ttl_min;
+        } else {
+            usage();
+        }
+    }
+    if (!load_rates.empty() && !outstanding_set) {
+        load_options.outstanding = 32768;
+    }
+    // Every outstanding query needs its own 16-bit query ID on the channel.
+    if (load_options.outstanding == 0 || load_options.outstanding > 32768 ||
+        load_options.names == 0 ||
+        load_options.ttl_max < load_options.ttl_min) {
+        usage();
+    }
+    const char *slash = strrchr(argv[1], '/');
+    bench_impl = slash ? slash + 1 : argv[1];
+    load_cares_impl(argv[1]);
+    int res = RUN_ALL_TESTS();
+    unload_cares_impl();
+    return res;
+}
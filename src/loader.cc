@@ -3,16 +3,31 @@
 #include <stdexcept>
 #include "loader.h"
 
+// Marks a library function as running for as long as it is in scope.
+class ImplApiScope {
+public:
+    ImplApiScope(const char *api) : prev_(impl_current_api) {
+        impl_current_api = api;
+    }
+    ~ImplApiScope() {
+        impl_current_api = prev_;
+    }
+private:
+    const char *prev_;
+};
+
 #define IMPL_SHIM(RET, FUNC, PARAMS, ARGS)                              \
     RET FUNC PARAMS {                                                   \
         RET (*fn) PARAMS = (RET (*) PARAMS) dlsym(impl.handle, #FUNC);  \
         if (!fn) {                                                      \
             throw std::runtime_error("not implemented: " #FUNC);        \
         }                                                               \
+        ImplApiScope scope(#FUNC);                                      \
         return fn ARGS;                                                 \
     }
 
 ares_impl_t impl;
+const char *impl_current_api = NULL;
 
 void load_cares_impl(const char *path) {
    impl.handle = dlopen(path, RTLD_LAZY);
@@ -39,23 +54,26 @@ IMPL_SHIM(int, ares_parse_uri_reply, (const unsigned char *abuf, int alen, struc
 IMPL_SHIM(int, ares_parse_txt_reply_ext, (const unsigned char *abuf, int alen, struct ares_txt_ext **txt_out), (abuf, alen, txt_out))
 
 IMPL_SHIM(void, ares_set_socket_functions, (ares_channel_t *channel, const struct ares_socket_functions *funcs, void *user_data), (channel, funcs, user_data));
+IMPL_SHIM(ares_status_t, ares_set_socket_functions_ex, (ares_channel_t *channel, const struct ares_socket_functions_ex *funcs, void *user_data), (channel, funcs, user_data));
 IMPL_SHIM(void, ares_gethostbyname, (ares_channel_t *channel, const char *name, int family, ares_host_callback callback, void *arg), (channel, name, family, callback, arg));
 IMPL_SHIM(int, ares_init_options, (ares_channel_t **channelptr, const struct ares_options *options, int optmask), (channelptr, options, optmask));
 IMPL_SHIM(void, ares_destroy, (ares_channel_t *channel), (channel));
-IMPL_SHIM(struct timeval *, ares_timeout, (ares_channel_t *channel, struct timeval *maxtv, struct timeval *tv), (channel, maxtv, tv));
+IMPL_SHIM(struct timeval *, ares_timeout, (const ares_channel_t *channel, struct timeval *maxtv, struct timeval *tv), (channel, maxtv, tv));
 IMPL_SHIM(void, ares_cancel, (ares_channel_t *channel), (channel));
 IMPL_SHIM(void, ares_process, (ares_channel_t *channel, fd_set *read_fds, fd_set *write_fds), (channel, read_fds, write_fds));
-IMPL_SHIM(int, ares_fds, (ares_channel_t *channel, fd_set *read_fds, fd_set *write_fds), (channel, read_fds, write_fds));
+IMPL_SHIM(void, ares_process_fd, (ares_channel_t *channel, ares_socket_t read_fd, ares_socket_t write_fd), (channel, read_fd, write_fd));
+IMPL_SHIM(int, ares_fds, (const ares_channel_t *channel, fd_set *read_fds, fd_set *write_fds), (channel, read_fds, write_fds));
 IMPL_SHIM(int, ares_gethostbyname_file, (ares_channel_t *channel, const char *name, int family, struct hostent **host), (channel, name, family, host));
 IMPL_SHIM(void, ares_gethostbyaddr, (ares_channel_t *channel, const void *addr, int addrlen, int family, ares_host_callback callback, void *arg), (channel, addr, addrlen, family, callback, arg));
 IMPL_SHIM(void, ares_search, (ares_channel_t *channel, const char *name, int dnsclass, int type, ares_callback callback, void *arg), (channel, name, dnsclass, type, callback, arg));
 IMPL_SHIM(void, ares_getnameinfo, (ares_channel_t *channel, const struct sockaddr *sa, ares_socklen_t salen, int flags, ares_nameinfo_callback callback, void *arg), (channel, sa, salen, flags, callback, arg));
-IMPL_SHIM(int, ares_getsock, (ares_channel_t *channel, ares_socket_t *socks, int numsocks), (channel, socks, numsocks));
-IMPL_SHIM(int, ares_dup, (ares_channel_t **dest, ares_channel_t *src), (dest, src));
+IMPL_SHIM(int, ares_getsock, (const ares_channel_t *channel, ares_socket_t *socks, int numsocks), (channel, socks, numsocks));
+IMPL_SHIM(int, ares_dup, (ares_channel_t **dest, const ares_channel_t *src), (dest, src));
 IMPL_SHIM(int, ares_set_servers, (ares_channel_t *channel, const struct ares_addr_node *servers), (channel, servers));
 IMPL_SHIM(int, ares_set_servers_ports, (ares_channel_t *channel, const struct ares_addr_port_node *servers), (channel, servers));
 IMPL_SHIM(int, ares_set_servers_csv, (ares_channel_t *channel, const char *servers), (channel, servers));
 IMPL_SHIM(int, ares_set_servers_ports_csv, (ares_channel_t *channel, const char *servers), (channel, servers));
+IMPL_SHIM(char *, ares_get_servers_csv, (const ares_channel_t *channel), (channel));
 
 IMPL_SHIM(void, ares_getaddrinfo, (ares_channel_t *channel, const char *node, const char *service, const struct ares_addrinfo_hints *hints, ares_addrinfo_callback callback, void *arg), (channel, node, service, hints, callback, arg));
 IMPL_SHIM(int, ares_inet_pton, (int af, const char *src, void *dst), (af, src, dst));
@@ -66,5 +84,7 @@ IMPL_SHIM(void, ares_free_string, (void *str), (str));
 IMPL_SHIM(void, ares_set_local_dev, (ares_channel_t *channel, const char *local_dev_name), (channel, local_dev_name));
 IMPL_SHIM(void, ares_set_local_ip4, (ares_channel_t *channel, unsigned int local_ip), (channel, local_ip));
 IMPL_SHIM(void, ares_set_local_ip6, (ares_channel_t *channel, const unsigned char *local_ip6), (channel, local_ip6));
-IMPL_SHIM(int, ares_save_options, (ares_channel_t *channel, struct ares_options *options, int *optmask), (channel, options, optmask));
+IMPL_SHIM(int, ares_save_options, (const ares_channel_t *channel, struct ares_options *options, int *optmask), (channel, options, optmask));
 IMPL_SHIM(void, ares_destroy_options, (struct ares_options *options), (options));
+IMPL_SHIM(int, ares_library_init_mem, (int flags, void *(*amalloc)(size_t size), void (*afree)(void *ptr), void *(*arealloc)(void *ptr, size_t size)), (flags, amalloc, afree, arealloc));
+IMPL_SHIM(void, ares_library_cleanup, (void), ());
@@ -7,5 +7,9 @@ typedef struct {
 
 extern ares_impl_t impl;
 
+// Name of the innermost library function running through the shims, or
+// NULL when none is, so that allocation hooks can tell who called them.
+extern const char *impl_current_api;
+
 void load_cares_impl(const char *path);
 void unload_cares_impl();
@@ -25,7 +25,18 @@ int main(int argc, char **argv) {
     }
     ::testing::InitGoogleTest(&argc, argv);
     load_cares_impl(argv[1]);
-    int res = RUN_ALL_TESTS();
+    int res;
+    {
+        // Count the library's allocations for the whole run, so that each
+        // test's leaks and peak heap can be reported.
+        CountingAllocator allocator;
+        HeapCheckListener *heap = new HeapCheckListener;
+        ::testing::UnitTest::GetInstance()->listeners().Append(heap);
+        res = RUN_ALL_TESTS();
+        if (!heap->leaked().empty()) {
+            res = 1;
+        }
+    }
     unload_cares_impl();
     return res;
 }